@@ -23,13 +23,47 @@ std::unique_ptr<AstroLink4Pi> astroLink4Pi(new AstroLink4Pi());
 #define ACS_TYPE 0		// 0 - 20A, 1 - 5A
 
 #define MAX_RESOLUTION 32							 // the highest resolution supported is 1/32 step
+#define MOTOR_SETTLE_TIME 50						 // ms at cruise current before switching to hold
 #define TEMPERATURE_UPDATE_TIMEOUT (5 * 1000)		 // 5 sec
 #define TEMPERATURE_COMPENSATION_TIMEOUT (30 * 1000) // 30 sec
 #define SYSTEM_UPDATE_PERIOD 1000
 #define POLL_PERIOD 200
-#define FAN_PERIOD (20 * 1000)
-
-#define TSL2591_ADC_TIME 750  // integration time in ms for a single increment
+#define SENSOR_IDLE_WAIT 50 // ms, longest sleep of the acquisition thread
+#define HOLD_UPDATE_PERIOD 1000
+#define I2C_STATS_PERIOD (10 * 1000)
+#define ENERGY_CHECKPOINT_PERIOD (60 * 1000)
+#define BATTERY_LOW_SOC 20 // % below which the battery status turns to alert
+#define BROWNOUT_DEBOUNCE 2		   // consecutive out of range samples before shedding
+#define BROWNOUT_STAGE_DELAY 100   // ms before the next load is shed while the fault persists
+#define BROWNOUT_RESTORE_STEP 2	   // s between restored loads
+#define BROWNOUT_MAX_LATENCY 50	   // ms, detection bound above which a warning is logged, 33 ms with the default scan
+#define BROWNOUT_INTERVAL_WINDOW 10000 // ms window of the Vin sample gap statistics
+#define LOAD_ENERGY_PERIOD 1000		   // ms between per load energy updates
+#define DEW_CONTROL_PERIOD 5000		   // ms between dew heater duty updates
+#define PWM_RAMP_PERIOD 20			   // ms between soft start duty steps, at least one PWM period
+#define FAN_FREQUENCY 100			   // Hz of the fan PWM, interleaved with the heaters only when they run at it too
+#define PWM_PEAK_SETTLE (60 * 1000)	   // ms the PWM phases must stay unchanged before the 1 min peak current is attributed
+#define SHED_EVENT_QUEUE 32
+#define BUDGET_AVERAGE_WINDOW 1000	   // ms of Ireal averaged by the power budget, at least two PWM periods
+#define PROFILE_SETTLE_BATCH 64		   // Ireal samples fetched per settle poll, more than 20 ms at 860 SPS
+#define CAPTURE_MONITOR_PERIOD 20	   // ms between Vin and Ireal samples during a capture until the scan interval is known
+#define THERMAL_HYSTERESIS 2.0 // C below the limit before full hold current is restored
+
+#define TSL2591_ADC_MARGIN 20  // ms added to the integration time before reading the result
+#define SHT_ADDR (0x44)
+#define SHT_CMD_FETCH "\xE0\x00"
+#define SHT_CMD_BREAK "\x30\x93"
+#define SHT_FETCH_SLACK 10	  // percent the fetch period exceeds the measurement period, the sensor clock is not exact
+#define SHT_FETCH_FAILURES 3  // consecutive failed fetches before periodic mode is restarted
+#define MLX_ADDR (0x5A)
+#define OLDSQM_ADDR (0x33)
+#define ADS1115_ADDR (0x48)
+#define ADC_READY_POLLS 5	// config register reads waiting for the end of a conversion
+#define ADC_READY_WAIT 200	// us between them
+#define ADC_ZERO_SAMPLES 64	// current samples averaged by the zero current calibration
+#define I2C_REOPEN_ERRORS 3 // consecutive errors before the device handle is reopened
+#define I2C_RETRY_MIN 1000	// ms before an unanswered device is opened again, doubled per failed handle
+#define I2C_RETRY_MAX 60000 // ms, longest wait between attempts
 #define TSL2591_ADDR (0x29)
 #define TSL2591_COMMAND_BIT (0xA0)  // bits 7 and 5 for 'command normal'
 #define TSL2591_ENABLE_POWERON (0x01)
@@ -59,6 +93,8 @@ std::unique_ptr<AstroLink4Pi> astroLink4Pi(new AstroLink4Pi());
 #define MOTOR_PWM 20
 #define CHK_IN_PIN 16
 #define FAN_PIN 13
+#define I2C_SDA_PIN 2
+#define I2C_SCL_PIN 3
 
 void ISPoll(void *p);
 
@@ -92,7 +128,7 @@ void ISNewNumber(const char *dev, const char *name, double values[], char *names
 	astroLink4Pi->ISNewNumber(dev, name, values, names, num);
 }
 
-AstroLink4Pi::AstroLink4Pi() : FI(this), WI(this)
+AstroLink4Pi::AstroLink4Pi() : FI(this), WI(this), motion(DIR_PIN, STP_PIN)
 {
 	setVersion(VERSION_MAJOR, VERSION_MINOR);
 }
@@ -104,6 +140,10 @@ AstroLink4Pi::~AstroLink4Pi()
 		_abort = true;
 		_motionThread.join();
 	}
+	stopProfileThread();
+	stopRampThread();
+	stopSensorThread();
+	stopPowerThread();
 }
 
 const char *AstroLink4Pi::getDefaultName()
@@ -126,6 +166,7 @@ bool AstroLink4Pi::Connect()
 		DEBUGF(INDI::Logger::DBG_ERROR, "Could not access GPIO. Error code %d , GPIO number %d", pigpioHandle, gpioType);
 		return false;
 	}
+	motion.setHandle(pigpioHandle);
 
 	lgGpioClaimOutput(pigpioHandle, 0, DECAY_PIN, 0);
 	lgGpioClaimOutput(pigpioHandle, 0, EN_PIN, 1); // EN_PIN start as disabled
@@ -135,12 +176,23 @@ bool AstroLink4Pi::Connect()
 	lgGpioClaimOutput(pigpioHandle, 0, RST_PIN, 1); // RST_PIN start as wake up
 	lgGpioClaimOutput(pigpioHandle, 0, STP_PIN, 0);
 	lgGpioClaimOutput(pigpioHandle, 0, DIR_PIN, 0);
-	lgGpioClaimOutput(pigpioHandle, 0, OUT1_PIN, relayState[0]);
-	lgGpioClaimOutput(pigpioHandle, 0, OUT2_PIN, relayState[1]);
+	// a startup profile keeps the outputs it sets off until their step comes
+	std::vector<ProfileStep> startupSteps;
+	std::string profileError;
+	if (!parsePowerProfile(PowerProfilesT[PROFILE_STARTUP].text, startupSteps, profileError))
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Startup power profile ignored: %s", profileError.c_str());
+	}
+	profileHold = profileOutputs(startupSteps);
+	lgGpioClaimOutput(pigpioHandle, 0, OUT1_PIN, (profileHold & (1 << LOAD_OUT1)) ? 0 : relayState[0]);
+	lgGpioClaimOutput(pigpioHandle, 0, OUT2_PIN, (profileHold & (1 << LOAD_OUT2)) ? 0 : relayState[1]);
 	lgGpioClaimOutput(pigpioHandle, 0, PWM1_PIN, 0);
 	lgGpioClaimOutput(pigpioHandle, 0, PWM2_PIN, 0);
 	lgGpioClaimOutput(pigpioHandle, 0, MOTOR_PWM, 0);
-	lgGpioClaimOutput(pigpioHandle, 0, FAN_PIN, 0);
+	for (PwmIssue &issued : pwmIssued)
+		issued = PwmIssue();
+	fanAvailable = (lgGpioClaimOutput(pigpioHandle, 0, FAN_PIN, 0) == 0);
+	claimHomeSwitch((int)HomeSwitchN[HOME_GPIO].value);
 
 	// Lock Relay Labels setting
 	RelayLabelsTP.s = IPS_BUSY;
@@ -189,7 +241,85 @@ bool AstroLink4Pi::Connect()
 	nextTemperatureRead = currentTime + TEMPERATURE_UPDATE_TIMEOUT;
 	nextTemperatureCompensation = currentTime + TEMPERATURE_COMPENSATION_TIMEOUT;
 	nextSystemRead = currentTime + SYSTEM_UPDATE_PERIOD;
-	nextFanUpdate = currentTime + 3000;
+	nextHoldUpdate = currentTime + HOLD_UPDATE_PERIOD;
+	lastHoldUpdate = currentTime;
+
+	// start sensor acquisition
+	initI2cDevices();
+	nextI2cStats = currentTime + I2C_STATS_PERIOD;
+	sensorSnapshot.reset();
+	lastSample = SensorSnapshot();
+	_sensorStop = false;
+	_sensorThread = std::thread(&AstroLink4Pi::sensorLoop, this);
+	if (revision >= 4)
+	{
+		for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+		{
+			adcRing[channel].reset();
+			adcGain[channel] = AdcGainN[channel].value;
+			adcOffset[channel] = AdcOffsetN[channel].value;
+		}
+		powerSamplesSeen = 0;
+		powerScanChanged = true;
+		zeroRequest = false;
+		zeroDone = false;
+		AdcZeroSP.s = IPS_IDLE;
+		energyAs = energyWs = 0;
+		chargeAs = 0;
+		energyReset = 0;
+		{
+			std::lock_guard<std::mutex> lock(loadMutex);
+			loadModel.resetEnergy();
+		}
+		nextLoadUpdate = 0;
+		powerStats.reset();
+		powerStatsSnapshot.reset();
+		powerStatsReset = false;
+		captureActive = false;
+		captureDone = false;
+		battery.reset();
+		brownout = BrownoutState();
+		vinIntervalMax = 0;
+		shedMask = 0;
+		motorHoldShed = false;
+		motorShedPending = false;
+		configureBrownout();
+		configureBudget();
+		powerBudget.reset();
+		lastBudgetUpdate = 0;
+		budgetChanged = 0;
+		pwmLimit[0] = pwmLimit[1] = 100;
+		loadEnergy();
+		nextEnergyCheckpoint = currentTime + ENERGY_CHECKPOINT_PERIOD;
+		_powerStop = false;
+		_powerThread = std::thread(&AstroLink4Pi::powerLoop, this);
+	}
+
+	for (int channel = 0; channel < 2; channel++)
+	{
+		configureDewHeater(channel);
+		dewControl[channel].reset();
+	}
+	lastDewUpdate = 0;
+
+	// fan pin is claimed once above, the controller only changes its duty
+	if (!systemMetrics.open())
+		DEBUG(INDI::Logger::DBG_WARNING, "Cannot open all system metrics, missing values are not updated and the fan runs at full speed.");
+	if (!fanAvailable)
+		DEBUGF(INDI::Logger::DBG_ERROR, "GPIO fan pin %d not available.", FAN_PIN);
+	configureFan();
+	fanControl.reset();
+	lastFanUpdate = 0;
+	nextFanUpdate = 0;
+
+	// heaters start from zero and ramp up to their duty
+	pwmRamped[0] = pwmRamped[1] = 0;
+	_rampStop = false;
+	rampActive = true;
+	_rampThread = std::thread(&AstroLink4Pi::rampLoop, this);
+
+	if (!startupSteps.empty())
+		startProfile(PROFILE_STARTUP);
 
 	SetTimer(POLL_PERIOD);
 	setCurrent(true);
@@ -201,6 +331,25 @@ bool AstroLink4Pi::Connect()
 
 bool AstroLink4Pi::Disconnect()
 {
+	// the shutdown profile runs to its end while the power monitor still works
+	stopProfileThread();
+	if (startProfile(PROFILE_SHUTDOWN))
+		_profileThread.join();
+	profileHold = 0;
+	profileOutputsChanged = false;
+	profileFinished = false;
+	stopRampThread();
+
+	stopSensorThread();
+	stopPowerThread();
+	// a zero calibration cut short by the disconnect is dropped
+	zeroRequest = false;
+	zeroDone = false;
+	AdcZeroSP.s = IPS_IDLE;
+	if (revision >= 4)
+		saveEnergy();
+	closeI2cDevices();
+
 	lgGpioWrite(pigpioHandle, RST_PIN, 0);					 // sleep
 	int enabledState = lgGpioWrite(pigpioHandle, EN_PIN, 1); // make disabled
 
@@ -211,6 +360,7 @@ bool AstroLink4Pi::Disconnect()
 	else
 	{
 		DEBUG(INDI::Logger::DBG_SESSION, "Focusing motor power disabled.");
+		motorCurrent = 0;
 	}
 
 	lgGpioFree(pigpioHandle, DECAY_PIN);
@@ -228,6 +378,13 @@ bool AstroLink4Pi::Disconnect()
 	lgGpioFree(pigpioHandle, PWM2_PIN);
 	lgGpioFree(pigpioHandle, MOTOR_PWM);
 	lgGpioFree(pigpioHandle, FAN_PIN);
+	releaseHomeSwitch();
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		fanDuty = -1;
+	}
+	fanAvailable = false;
+	systemMetrics.close();
 
 	lgGpiochipClose(pigpioHandle);
 
@@ -278,6 +435,22 @@ bool AstroLink4Pi::initProperties()
 	IUFillSwitch(&FocusHoldS[HOLD_100], "HOLD_100", "100%", ISS_OFF);
 	IUFillSwitchVector(&FocusHoldSP, FocusHoldS, 6, getDeviceName(), "FOCUS_HOLD", "Hold power", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
 
+	// Hold power reduction when idle
+	IUFillNumber(&HoldDecayN[HOLD_DECAY_TIME], "HOLD_DECAY_TIME", "Reduce after idle [s] (0 = never)", "%0.0f", 0, 3600, 10, 0);
+	IUFillNumber(&HoldDecayN[HOLD_DECAY_LEVEL], "HOLD_DECAY_LEVEL", "Reduced hold power [%]", "%0.0f", 0, 100, 5, 20);
+	IUFillNumberVector(&HoldDecayNP, HoldDecayN, 2, getDeviceName(), "FOCUS_HOLD_DECAY", "Idle hold", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	// Motor thermal model
+	IUFillNumber(&MotorThermalN[THERMAL_R_COIL], "THERMAL_R_COIL", "Coil resistance [ohm]", "%0.1f", 0.1, 100, 0.1, 3);
+	IUFillNumber(&MotorThermalN[THERMAL_R_TH], "THERMAL_R_TH", "Thermal resistance [C/W]", "%0.1f", 1, 100, 1, 15);
+	IUFillNumber(&MotorThermalN[THERMAL_TAU], "THERMAL_TAU", "Time constant [s]", "%0.0f", 10, 7200, 10, 900);
+	IUFillNumber(&MotorThermalN[THERMAL_MAX_RISE], "THERMAL_MAX_RISE", "Max. hold temp. rise [C]", "%0.0f", 5, 80, 1, 40);
+	IUFillNumberVector(&MotorThermalNP, MotorThermalN, 4, getDeviceName(), "MOTOR_THERMAL_MODEL", "Motor thermal model", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&MotorTemperatureN[MOTOR_CURRENT], "MOTOR_CURRENT", "Motor current [mA]", "%0.0f", 0, 3000, 1, 0);
+	IUFillNumber(&MotorTemperatureN[MOTOR_TEMP_RISE], "MOTOR_TEMP_RISE", "Est. temperature rise [C]", "%0.1f", 0, 200, 1, 0);
+	IUFillNumberVector(&MotorTemperatureNP, MotorTemperatureN, 2, getDeviceName(), "MOTOR_TEMPERATURE", "Motor", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
+
 	// Step delay setting
 	IUFillNumber(&FocusStepDelayN[0], "FOCUS_STEPDELAY_VALUE", "microseconds", "%0.0f", 200, 20000, 1, 2000);
 	IUFillNumberVector(&FocusStepDelayNP, FocusStepDelayN, 1, getDeviceName(), "FOCUS_STEPDELAY", "Step Delay", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
@@ -285,6 +458,14 @@ bool AstroLink4Pi::initProperties()
 	IUFillNumber(&PWMcycleN[0], "PWMcycle", "PWM freq. [Hz]", "%0.0f", 10, 1000, 10, 20);
 	IUFillNumberVector(&PWMcycleNP, PWMcycleN, 1, getDeviceName(), "PWMCYCLE", "PWM frequency", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
+	// SHT3x measurement rate
+	IUFillSwitch(&ShtRateS[SHT_RATE_05], "SHT_RATE_05", "0.5 Hz", ISS_OFF);
+	IUFillSwitch(&ShtRateS[SHT_RATE_1], "SHT_RATE_1", "1 Hz", ISS_ON);
+	IUFillSwitch(&ShtRateS[SHT_RATE_2], "SHT_RATE_2", "2 Hz", ISS_OFF);
+	IUFillSwitch(&ShtRateS[SHT_RATE_4], "SHT_RATE_4", "4 Hz", ISS_OFF);
+	IUFillSwitch(&ShtRateS[SHT_RATE_10], "SHT_RATE_10", "10 Hz", ISS_OFF);
+	IUFillSwitchVector(&ShtRateSP, ShtRateS, SHT_RATE_COUNT, getDeviceName(), "SHT_RATE", "Humidity sensor rate", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
 	// Focuser temperature
 	IUFillNumber(&FocusTemperatureN[0], "FOCUS_TEMPERATURE_VALUE", "°C", "%0.2f", -50, 50, 1, 0);
 	IUFillNumberVector(&FocusTemperatureNP, FocusTemperatureN, 1, getDeviceName(), "FOCUS_TEMPERATURE", "Temperature", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
@@ -308,6 +489,25 @@ bool AstroLink4Pi::initProperties()
 	IUFillNumber(&FocuserTravelN[0], "FOCUSER_TRAVEL_VALUE", "mm", "%0.0f", 10, 200, 10, 10);
 	IUFillNumberVector(&FocuserTravelNP, FocuserTravelN, 1, getDeviceName(), "FOCUSER_TRAVEL", "Max Travel", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
+	// Move quantization to a fraction of the critical focus zone
+	IUFillSwitch(&CfzPolicyS[CFZ_POLICY_ON], "CFZ_POLICY_ON", "Enable", ISS_OFF);
+	IUFillSwitch(&CfzPolicyS[CFZ_POLICY_OFF], "CFZ_POLICY_OFF", "Disable", ISS_ON);
+	IUFillSwitchVector(&CfzPolicySP, CfzPolicyS, 2, getDeviceName(), "FOCUS_CFZ_POLICY", "CFZ quantization", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+	IUFillNumber(&CfzFractionN[0], "CFZ_FRACTION", "Fraction of CFZ", "%0.2f", 0.05, 1, 0.05, 0.25);
+	IUFillNumberVector(&CfzFractionNP, CfzFractionN, 1, getDeviceName(), "FOCUS_CFZ_FRACTION", "CFZ quantum", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	// Home switch
+	IUFillNumber(&HomeSwitchN[HOME_GPIO], "HOME_GPIO", "Switch GPIO (0 = none)", "%0.0f", 0, 27, 1, 0);
+	IUFillNumber(&HomeSwitchN[HOME_POSITION], "HOME_POSITION", "Position at switch", "%0.0f", 0, 100000, 1, 0);
+	IUFillNumber(&HomeSwitchN[HOME_BACKOFF], "HOME_BACKOFF", "Back-off steps", "%0.0f", 1, 10000, 10, 200);
+	IUFillNumber(&HomeSwitchN[HOME_FAST_DELAY], "HOME_FAST_DELAY", "Fast seek delay [us]", "%0.0f", 200, 20000, 1, 500);
+	IUFillNumber(&HomeSwitchN[HOME_SLOW_DELAY], "HOME_SLOW_DELAY", "Slow seek delay [us]", "%0.0f", 200, 20000, 1, 5000);
+	IUFillNumberVector(&HomeSwitchNP, HomeSwitchN, 5, getDeviceName(), "FOCUS_HOME_SWITCH", "Home switch", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	// Homing
+	IUFillSwitch(&FocusHomeS[0], "FOCUS_HOME_GO", "Find home", ISS_OFF);
+	IUFillSwitchVector(&FocusHomeSP, FocusHomeS, 1, getDeviceName(), "FOCUS_HOME", "Homing", MAIN_CONTROL_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
 	// Scope params
 	IUFillNumber(&ScopeParametersN[SCOPE_DIAM], "SCOPE_DIAM", "Aperture (mm)", "%0.0f", 10, 5000, 0, 0.0);
 	IUFillNumber(&ScopeParametersN[SCOPE_FL], "SCOPE_FL", "Focal Length (mm)", "%0.0f", 10, 10000, 0, 0.0);
@@ -326,27 +526,70 @@ bool AstroLink4Pi::initProperties()
 	IUFillText(&SysInfoT[SYSI_PUBIP], "SYSI_PUBIP", "Public IP", NULL);
 	IUFillTextVector(&SysInfoTP, SysInfoT, 7, getDeviceName(), "SYSTEM_INFO", "System Info", SYSTEM_TAB, IP_RO, 60, IPS_IDLE);
 
-	IUFillNumber(&FanPowerN[0], "FAN_PWR", "Speed [%]", "%0.0f", 0, 100, 1, 33);
-	IUFillNumberVector(&FanPowerNP, FanPowerN, 1, getDeviceName(), "FAN_POWER", "Internal fan", SYSTEM_TAB, IP_RO, 60, IPS_IDLE);
+	IUFillText(&I2cStatsT[I2C_SHT], "I2C_SHT", "SHT (0x44)", NULL);
+	IUFillText(&I2cStatsT[I2C_MLX], "I2C_MLX", "MLX (0x5A)", NULL);
+	IUFillText(&I2cStatsT[I2C_TSL], "I2C_TSL", "TSL (0x29)", NULL);
+	IUFillText(&I2cStatsT[I2C_OLDSQM], "I2C_SQM", "SQM (0x33)", NULL);
+	IUFillText(&I2cStatsT[I2C_ADC], "I2C_ADC", "ADC (0x48)", NULL);
+	IUFillTextVector(&I2cStatsTP, I2cStatsT, I2C_COUNT, getDeviceName(), "I2C_DIAGNOSTICS", "I2C devices", SYSTEM_TAB, IP_RO, 60, IPS_IDLE);
+
+	IUFillNumber(&FanPowerN[0], "FAN_PWR", "Speed [%]", "%0.0f", 0, 100, 1, 0);
+	IUFillNumber(&FanPowerN[1], "FAN_CPU_TEMP", "CPU [C]", "%0.1f", 0, 120, 0, 0);
+	IUFillNumberVector(&FanPowerNP, FanPowerN, 2, getDeviceName(), "FAN_POWER", "Internal fan", SYSTEM_TAB, IP_RO, 60, IPS_IDLE);
+
+	IUFillNumber(&FanSettingsN[FAN_TARGET], "FAN_TARGET", "CPU target [C]", "%0.1f", 30, 85, 1, 55);
+	IUFillNumber(&FanSettingsN[FAN_HYSTERESIS], "FAN_HYSTERESIS", "Start/stop band [C]", "%0.1f", 0.5, 15, 0.5, 3);
+	IUFillNumber(&FanSettingsN[FAN_MIN_DUTY], "FAN_MIN_DUTY", "Minimum spin [%]", "%0.0f", 0, 100, 5, 25);
+	IUFillNumber(&FanSettingsN[FAN_KP], "FAN_KP", "Kp [%/C]", "%0.1f", 0, 100, 1, 6);
+	IUFillNumber(&FanSettingsN[FAN_KI], "FAN_KI", "Ki [%/C/min]", "%0.1f", 0, 100, 1, 10);
+	IUFillNumber(&FanSettingsN[FAN_KD], "FAN_KD", "Kd [%/(C/s)]", "%0.1f", 0, 100, 1, 0);
+	IUFillNumber(&FanSettingsN[FAN_RATE], "FAN_RATE", "Update period [s]", "%0.1f", 0.2, 60, 0.2, 2);
+	IUFillNumberVector(&FanSettingsNP, FanSettingsN, 7, getDeviceName(), "FAN_CONTROL", "Internal fan", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
 	IUFillText(&RelayLabelsT[LAB_OUT1], "LAB_OUT1", "OUT 1", "OUT 1");
 	IUFillText(&RelayLabelsT[LAB_OUT2], "LAB_OUT2", "OUT 2", "OUT 2");
 	IUFillText(&RelayLabelsT[LAB_PWM1], "LAB_PWM1", "PWM 1", "PWM 1");
 	IUFillText(&RelayLabelsT[LAB_PWM2], "LAB_PWM2", "PWM 2", "PWM 2");
 	IUFillTextVector(&RelayLabelsTP, RelayLabelsT, 4, getDeviceName(), "RELAYLABELS", "Relay Labels", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+	// power profiles, e.g. "OUT1=on; settle 0.2 5000; OUT2=on; delay 2000; PWM1=40"
+	IUFillText(&PowerProfilesT[PROFILE_STARTUP], "PROFILE_STARTUP", "On connect", "");
+	IUFillText(&PowerProfilesT[PROFILE_SHUTDOWN], "PROFILE_SHUTDOWN", "On disconnect", "");
+	IUFillText(&PowerProfilesT[PROFILE_CUSTOM], "PROFILE_CUSTOM", "Custom", "");
+	IUFillTextVector(&PowerProfilesTP, PowerProfilesT, PROFILE_COUNT, getDeviceName(), "POWER_PROFILES", "Power profiles", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+	IUFillSwitch(&PowerProfileS[PROFILE_STARTUP], "RUN_STARTUP", "On connect", ISS_OFF);
+	IUFillSwitch(&PowerProfileS[PROFILE_SHUTDOWN], "RUN_SHUTDOWN", "On disconnect", ISS_OFF);
+	IUFillSwitch(&PowerProfileS[PROFILE_CUSTOM], "RUN_CUSTOM", "Custom", ISS_OFF);
+	IUFillSwitch(&PowerProfileS[PROFILE_COUNT], "RUN_ABORT", "Abort", ISS_OFF);
+	IUFillSwitchVector(&PowerProfileSP, PowerProfileS, PROFILE_COUNT + 1, getDeviceName(), "POWER_PROFILE_RUN", "Run profile", OUTPUTS_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
 	
 	IUFillNumber(&SQMOffsetN[0], "SQMOffset", "mag/arcsec2", "%0.2f", -1, 1, 0.01, 0);
 	IUFillNumberVector(&SQMOffsetNP, SQMOffsetN, 1, getDeviceName(), "SQMOFFSET", "SQM calibration", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);    
+
+	IUFillNumber(&SqmSmoothingN[0], "SQM_TIME_CONSTANT", "Time constant [s]", "%0.0f", 1, 3600, 1, 10);
+	IUFillNumberVector(&SqmSmoothingNP, SqmSmoothingN, 1, getDeviceName(), "SQM_SMOOTHING", "SQM smoothing", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+	IUFillNumber(&SqmStatsN[0], "SQM_ERROR", "Std. error [mag/arcsec2]", "%0.3f", 0, 10, 0, 0);
+	IUFillNumber(&SqmStatsN[1], "SQM_SAMPLES", "Effective integrations", "%0.1f", 0, 100000, 0, 0);
+	IUFillNumberVector(&SqmStatsNP, SqmStatsN, 2, getDeviceName(), "SQM_STATISTICS", "SQM statistics", ENVIRONMENT_TAB, IP_RO, 60, IPS_IDLE);
 	
 
 	// Load options before connecting
 	// load config before defining switches
 	defineProperty(&RelayLabelsTP);
+	defineProperty(&PowerProfilesTP);
 	loadConfig();
 
 	IUFillNumber(&StepperCurrentN[0], "STEPPER_CURRENT", "mA", "%0.0f", 200, 2000, 50, 400);
 	IUFillNumberVector(&StepperCurrentNP, StepperCurrentN, 1, getDeviceName(), "STEPPER_CURRENT", "Stepper current", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
+	// Motor current per motion phase, relative to the stepper current
+	IUFillNumber(&CurrentProfileN[PROFILE_BOOST], "PROFILE_BOOST", "Acceleration current [%]", "%0.0f", 50, 150, 5, 100);
+	IUFillNumber(&CurrentProfileN[PROFILE_CRUISE], "PROFILE_CRUISE", "Cruise current [%]", "%0.0f", 20, 100, 5, 100);
+	IUFillNumber(&CurrentProfileN[PROFILE_RAMP], "PROFILE_RAMP", "Acceleration steps", "%0.0f", 0, 5000, 10, 0);
+	IUFillNumberVector(&CurrentProfileNP, CurrentProfileN, 3, getDeviceName(), "STEPPER_CURRENT_PROFILE", "Current profile", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
 	IUFillSwitch(&Switch1S[S1_ON], "S1_ON", "ON", ISS_OFF);
 	IUFillSwitch(&Switch1S[S1_OFF], "S1_OFF", "OFF", ISS_ON);
 	IUFillSwitchVector(&Switch1SP, Switch1S, 2, getDeviceName(), "SWITCH_1", RelayLabelsT[0].text, OUTPUTS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
@@ -361,6 +604,66 @@ bool AstroLink4Pi::initProperties()
 	IUFillNumber(&PWM2N[0], "PWMout2", "%", "%0.0f", 0, 100, 10, 0);
 	IUFillNumberVector(&PWM2NP, PWM2N, 1, getDeviceName(), "PWMOUT2", RelayLabelsT[3].text, OUTPUTS_TAB, IP_RW, 60, IPS_IDLE);
 
+	// dew heater control of the PWM outputs
+	for (int channel = 0; channel < 2; channel++)
+	{
+		char propName[MAXINDINAME], propLabel[MAXINDILABEL];
+		IUFillSwitch(&DewControlS[channel][DEW_MANUAL], "DEW_MANUAL", "Manual", ISS_ON);
+		IUFillSwitch(&DewControlS[channel][DEW_AUTO], "DEW_AUTO", "Dew point", ISS_OFF);
+		snprintf(propName, MAXINDINAME, "DEW_CONTROL_%d", channel + 1);
+		snprintf(propLabel, MAXINDILABEL, "PWM %d control", channel + 1);
+		IUFillSwitchVector(&DewControlSP[channel], DewControlS[channel], 2, getDeviceName(), propName, propLabel, OUTPUTS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+		IUFillNumber(&DewSettingsN[channel][DEW_MARGIN], "DEW_MARGIN", "Margin over dew point [C]", "%0.1f", 0, 20, 0.5, 3);
+		IUFillNumber(&DewSettingsN[channel][DEW_GAIN], "DEW_GAIN", "Optic rise at 100% [C]", "%0.1f", 0.5, 50, 0.5, 8);
+		IUFillNumber(&DewSettingsN[channel][DEW_TAU], "DEW_TAU", "Optic time constant [s]", "%0.0f", 10, 7200, 10, 600);
+		IUFillNumber(&DewSettingsN[channel][DEW_KP], "DEW_KP", "Kp [%/C]", "%0.1f", 0, 100, 1, 10);
+		IUFillNumber(&DewSettingsN[channel][DEW_KI], "DEW_KI", "Ki [%/C/min]", "%0.2f", 0, 50, 0.5, 2);
+		IUFillNumber(&DewSettingsN[channel][DEW_SKY_COUPLING], "DEW_SKY_COUPLING", "Sky coupling (0 off)", "%0.2f", 0, 1, 0.05, 0.2);
+		snprintf(propName, MAXINDINAME, "DEW_HEATER_%d", channel + 1);
+		snprintf(propLabel, MAXINDILABEL, "PWM %d dew heater", channel + 1);
+		IUFillNumberVector(&DewSettingsNP[channel], DewSettingsN[channel], 6, getDeviceName(), propName, propLabel, OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+	}
+
+	IUFillNumber(&DewStatusN[0], "DEW_DUTY_1", "PWM 1 applied duty [%]", "%0.0f", 0, 100, 0, 0);
+	IUFillNumber(&DewStatusN[1], "DEW_DUTY_2", "PWM 2 applied duty [%]", "%0.0f", 0, 100, 0, 0);
+	IUFillNumber(&DewStatusN[2], "DEW_OPTIC_1", "PWM 1 optic [C]", "%0.1f", -50, 50, 0, 0);
+	IUFillNumber(&DewStatusN[3], "DEW_OPTIC_2", "PWM 2 optic [C]", "%0.1f", -50, 50, 0, 0);
+	IUFillNumber(&DewStatusN[4], "DEW_ENERGY_1", "PWM 1 energy [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&DewStatusN[5], "DEW_ENERGY_2", "PWM 2 energy [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumberVector(&DewStatusNP, DewStatusN, 6, getDeviceName(), "DEW_HEATER_STATUS", "Dew heaters", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	IUFillNumber(&PwmRampN[0], "RAMP_PWM1", "PWM 1 ramp [%/s] (0 off)", "%0.0f", 0, 1000, 5, 0);
+	IUFillNumber(&PwmRampN[1], "RAMP_PWM2", "PWM 2 ramp [%/s] (0 off)", "%0.0f", 0, 1000, 5, 0);
+	IUFillNumberVector(&PwmRampNP, PwmRampN, 2, getDeviceName(), "PWM_RAMP", "PWM soft start", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillSwitch(&PwmPhaseS[PWM_ALIGNED], "PWM_ALIGNED", "Aligned", ISS_ON);
+	IUFillSwitch(&PwmPhaseS[PWM_INTERLEAVED], "PWM_INTERLEAVED", "Interleaved", ISS_OFF);
+	IUFillSwitchVector(&PwmPhaseSP, PwmPhaseS, 2, getDeviceName(), "PWM_PHASE", "PWM phases", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillNumber(&PwmPeakN[PWM_PEAK_ALIGNED], "PEAK_ALIGNED", "Approx. peak aligned, 1 min scan [A]", "%0.2f", 0, 20, 0, 0);
+	IUFillNumber(&PwmPeakN[PWM_PEAK_INTERLEAVED], "PEAK_INTERLEAVED", "Approx. peak interleaved, 1 min scan [A]", "%0.2f", 0, 20, 0, 0);
+	IUFillNumber(&PwmPeakN[PWM_OVERLAP], "PWM_OVERLAP", "On-time overlap [%]", "%0.0f", 0, 100, 0, 0);
+	IUFillNumber(&PwmPeakN[PWM_CAPTURE_ALIGNED], "CAPTURE_PEAK_ALIGNED", "Captured peak aligned [A]", "%0.2f", 0, 20, 0, 0);
+	IUFillNumber(&PwmPeakN[PWM_CAPTURE_INTERLEAVED], "CAPTURE_PEAK_INTERLEAVED", "Captured peak interleaved [A]", "%0.2f", 0, 20, 0, 0);
+	IUFillNumberVector(&PwmPeakNP, PwmPeakN, 5, getDeviceName(), "PWM_PEAK_CURRENT", "PWM peak current", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	// power budget, heaters are throttled in the LOAD_SHED_ORDER priority
+	IUFillSwitch(&BudgetS[0], "BUDGET_ENABLE", "Enable", ISS_OFF);
+	IUFillSwitch(&BudgetS[1], "BUDGET_DISABLE", "Disable", ISS_ON);
+	IUFillSwitchVector(&BudgetSP, BudgetS, 2, getDeviceName(), "POWER_BUDGET", "Power budget", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillNumber(&BudgetSettingsN[0], "BUDGET_ITOT_MAX", "Max total current [A] (0 off)", "%0.1f", 0, 20, 0.5, 10);
+	IUFillNumber(&BudgetSettingsN[1], "BUDGET_PTOT_MAX", "Max total power [W] (0 off)", "%0.0f", 0, 300, 5, 0);
+	IUFillNumber(&BudgetSettingsN[2], "BUDGET_HYSTERESIS", "Release below budget [A]", "%0.2f", 0, 5, 0.1, 0.5);
+	IUFillNumber(&BudgetSettingsN[3], "BUDGET_RELEASE", "Release rate [%/s]", "%0.0f", 1, 100, 1, 5);
+	IUFillNumberVector(&BudgetSettingsNP, BudgetSettingsN, 4, getDeviceName(), "POWER_BUDGET_SETTINGS", "Power budget", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&BudgetStatusN[0], "BUDGET_LIMIT_PWM1", "PWM 1 limit [%]", "%0.0f", 0, 100, 0, 100);
+	IUFillNumber(&BudgetStatusN[1], "BUDGET_LIMIT_PWM2", "PWM 2 limit [%]", "%0.0f", 0, 100, 0, 100);
+	IUFillNumber(&BudgetStatusN[2], "BUDGET_HEADROOM", "Headroom [A]", "%0.2f", -20, 20, 0, 0);
+	IUFillNumberVector(&BudgetStatusNP, BudgetStatusN, 3, getDeviceName(), "POWER_BUDGET_STATUS", "Power budget", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
 	// Power readings
 	IUFillNumber(&PowerReadingsN[POW_VIN], "POW_VIN", "Input voltage [V]", "%0.2f", 0, 15, 10, 0);
 	IUFillNumber(&PowerReadingsN[POW_VREG], "POW_VREG", "Regulated voltage [V]", "%0.2f", 0, 15, 10, 0);
@@ -370,6 +673,175 @@ bool AstroLink4Pi::initProperties()
 	IUFillNumber(&PowerReadingsN[POW_WH], "POW_WH", "Energy consumed [Wh]", "%0.2f", 0, 100000, 1, 0);
 	IUFillNumberVector(&PowerReadingsNP, PowerReadingsN, 6, getDeviceName(), "POWER_READINGS", "Power readings", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
 
+	// energy counters, POWER_READINGS carries the session values
+	IUFillNumber(&EnergyCountersN[0], "LIFETIME_AH", "Lifetime [Ah]", "%0.2f", 0, 1e9, 0, 0);
+	IUFillNumber(&EnergyCountersN[1], "LIFETIME_WH", "Lifetime [Wh]", "%0.2f", 0, 1e9, 0, 0);
+	IUFillNumberVector(&EnergyCountersNP, EnergyCountersN, 2, getDeviceName(), "ENERGY_LIFETIME", "Energy since reset", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	IUFillSwitch(&EnergyResetS[0], "ENERGY_RESET_SESSION", "Session", ISS_OFF);
+	IUFillSwitch(&EnergyResetS[1], "ENERGY_RESET_LIFETIME", "Lifetime", ISS_OFF);
+	IUFillSwitchVector(&EnergyResetSP, EnergyResetS, 2, getDeviceName(), "ENERGY_RESET", "Reset energy", OUTPUTS_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
+	// battery model
+	IUFillSwitch(&BatteryTypeS[BATTERY_NONE], "BATTERY_NONE", "Mains supply", ISS_ON);
+	IUFillSwitch(&BatteryTypeS[BATTERY_LIFEPO4_4S], "BATTERY_LIFEPO4_4S", "LiFePO4 12.8V", ISS_OFF);
+	IUFillSwitch(&BatteryTypeS[BATTERY_LEAD_ACID], "BATTERY_LEAD_ACID", "Lead acid 12V", ISS_OFF);
+	IUFillSwitch(&BatteryTypeS[BATTERY_LIION_3S], "BATTERY_LIION_3S", "Li-ion 3S", ISS_OFF);
+	IUFillSwitchVector(&BatteryTypeSP, BatteryTypeS, BATTERY_TYPE_COUNT, getDeviceName(), "BATTERY_TYPE", "Battery", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillNumber(&BatterySettingsN[0], "BATTERY_CAPACITY", "Capacity [Ah]", "%0.1f", 1, 1000, 1, 100);
+	IUFillNumber(&BatterySettingsN[1], "BATTERY_RESISTANCE", "Internal resistance [Ohm]", "%0.3f", 0, 1, 0.001, 0.02);
+	IUFillNumber(&BatterySettingsN[2], "BATTERY_AVERAGE", "Average load window [min]", "%0.0f", 1, 240, 1, 10);
+	IUFillNumberVector(&BatterySettingsNP, BatterySettingsN, 3, getDeviceName(), "BATTERY_SETTINGS", "Battery settings", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&BatteryStatusN[0], "BATTERY_SOC", "State of charge [%]", "%0.1f", 0, 100, 0, 0);
+	IUFillNumber(&BatteryStatusN[1], "BATTERY_REMAINING", "Remaining [Ah]", "%0.1f", 0, 1000, 0, 0);
+	IUFillNumber(&BatteryStatusN[2], "BATTERY_RUNTIME", "Runtime at current load [h]", "%0.1f", 0, 10000, 0, 0);
+	IUFillNumber(&BatteryStatusN[3], "BATTERY_RUNTIME_AVG", "Runtime at average load [h]", "%0.1f", 0, 10000, 0, 0);
+	IUFillNumber(&BatteryStatusN[4], "BATTERY_AVG_CURRENT", "Average load [A]", "%0.2f", -20, 20, 0, 0);
+	IUFillNumberVector(&BatteryStatusNP, BatteryStatusN, 5, getDeviceName(), "BATTERY_STATUS", "Battery", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	// brownout and overcurrent load shedding
+	IUFillSwitch(&BrownoutS[0], "BROWNOUT_ENABLE", "Enable", ISS_OFF);
+	IUFillSwitch(&BrownoutS[1], "BROWNOUT_DISABLE", "Disable", ISS_ON);
+	IUFillSwitchVector(&BrownoutSP, BrownoutS, 2, getDeviceName(), "BROWNOUT_PROTECTION", "Load shedding", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillNumber(&BrownoutSettingsN[0], "BROWNOUT_VIN_MIN", "Min input voltage [V]", "%0.2f", 5, 15, 0.1, 10.8);
+	IUFillNumber(&BrownoutSettingsN[1], "BROWNOUT_ITOT_MAX", "Max total current [A]", "%0.1f", 0.5, 20, 0.5, 15);
+	IUFillNumber(&BrownoutSettingsN[2], "BROWNOUT_HYSTERESIS", "Voltage hysteresis [V]", "%0.2f", 0, 3, 0.1, 0.5);
+	IUFillNumber(&BrownoutSettingsN[3], "BROWNOUT_RESTORE", "Restore after [s]", "%0.0f", 1, 600, 1, 10);
+	IUFillNumberVector(&BrownoutSettingsNP, BrownoutSettingsN, 4, getDeviceName(), "BROWNOUT_SETTINGS", "Load shedding limits", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&ShedOrderN[LOAD_PWM1], "SHED_PWM1", "PWM 1", "%0.0f", 0, LOAD_COUNT, 1, 1);
+	IUFillNumber(&ShedOrderN[LOAD_PWM2], "SHED_PWM2", "PWM 2", "%0.0f", 0, LOAD_COUNT, 1, 2);
+	IUFillNumber(&ShedOrderN[LOAD_OUT1], "SHED_OUT1", "OUT 1", "%0.0f", 0, LOAD_COUNT, 1, 3);
+	IUFillNumber(&ShedOrderN[LOAD_OUT2], "SHED_OUT2", "OUT 2", "%0.0f", 0, LOAD_COUNT, 1, 4);
+	IUFillNumber(&ShedOrderN[LOAD_MOTOR], "SHED_MOTOR", "Motor hold", "%0.0f", 0, LOAD_COUNT, 1, 5);
+	IUFillNumberVector(&ShedOrderNP, ShedOrderN, LOAD_COUNT, getDeviceName(), "LOAD_SHED_ORDER", "Shedding order (0 never)", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&BrownoutStatusN[BROWNOUT_SHED], "BROWNOUT_SHED", "Loads shed", "%0.0f", 0, LOAD_COUNT, 0, 0);
+	IUFillNumber(&BrownoutStatusN[BROWNOUT_LAST_LATENCY], "BROWNOUT_LAST_LATENCY", "Last reaction [ms]", "%0.1f", 0, 10000, 0, 0);
+	IUFillNumber(&BrownoutStatusN[BROWNOUT_MAX_LATENCY], "BROWNOUT_MAX_LATENCY", "Max reaction [ms]", "%0.1f", 0, 10000, 0, 0);
+	IUFillNumber(&BrownoutStatusN[BROWNOUT_BOUND], "BROWNOUT_BOUND", "Detection bound [ms]", "%0.1f", 0, 10000, 0, 0);
+	IUFillNumberVector(&BrownoutStatusNP, BrownoutStatusN, 4, getDeviceName(), "BROWNOUT_STATUS", "Load shedding", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	// per load consumption estimated from the total current
+	IUFillNumber(&LoadModelsN[LOAD_PWM1], "MODEL_PWM1", "PWM 1 at 100% [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumber(&LoadModelsN[LOAD_PWM2], "MODEL_PWM2", "PWM 2 at 100% [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumber(&LoadModelsN[LOAD_OUT1], "MODEL_OUT1", "OUT 1 [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumber(&LoadModelsN[LOAD_OUT2], "MODEL_OUT2", "OUT 2 [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumber(&LoadModelsN[LOAD_MOTOR], "MODEL_MOTOR", "Motor per phase A [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumberVector(&LoadModelsNP, LoadModelsN, LOAD_COUNT, getDeviceName(), "LOAD_MODELS", "Learned load current", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	IUFillNumber(&LoadEnergyN[LOAD_PWM1], "ENERGY_PWM1", "PWM 1 [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&LoadEnergyN[LOAD_PWM2], "ENERGY_PWM2", "PWM 2 [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&LoadEnergyN[LOAD_OUT1], "ENERGY_OUT1", "OUT 1 [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&LoadEnergyN[LOAD_OUT2], "ENERGY_OUT2", "OUT 2 [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&LoadEnergyN[LOAD_MOTOR], "ENERGY_MOTOR", "Motor [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumber(&LoadEnergyN[LOAD_COUNT], "ENERGY_OTHER", "Other [Wh]", "%0.2f", 0, 100000, 0, 0);
+	IUFillNumberVector(&LoadEnergyNP, LoadEnergyN, LOAD_COUNT + 1, getDeviceName(), "LOAD_ENERGY", "Energy per output", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	// ADS1115 scan sequencer, the defaults sample Vin often enough for the brownout detection bound
+	IUFillSwitch(&AdcRateS[0], "ADC_RATE_8", "8 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[1], "ADC_RATE_16", "16 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[2], "ADC_RATE_32", "32 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[3], "ADC_RATE_64", "64 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[4], "ADC_RATE_128", "128 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[5], "ADC_RATE_250", "250 SPS", ISS_ON);
+	IUFillSwitch(&AdcRateS[6], "ADC_RATE_475", "475 SPS", ISS_OFF);
+	IUFillSwitch(&AdcRateS[7], "ADC_RATE_860", "860 SPS", ISS_OFF);
+	IUFillSwitchVector(&AdcRateSP, AdcRateS, ADC_RATE_COUNT, getDeviceName(), "ADC_SCAN_RATE", "Power ADC rate", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillNumber(&AdcWeightsN[ADC_VIN], "ADC_WEIGHT_VIN", "Vin", "%0.0f", 0, 10, 1, 2);
+	IUFillNumber(&AdcWeightsN[ADC_VREG], "ADC_WEIGHT_VREG", "Vreg", "%0.0f", 0, 10, 1, 1);
+	IUFillNumber(&AdcWeightsN[ADC_ITOT], "ADC_WEIGHT_ITOT", "Itot", "%0.0f", 0, 10, 1, 0);
+	IUFillNumber(&AdcWeightsN[ADC_IREF], "ADC_WEIGHT_IREF", "Iref", "%0.0f", 0, 10, 1, 0);
+	IUFillNumber(&AdcWeightsN[ADC_IREAL], "ADC_WEIGHT_IREAL", "Ireal", "%0.0f", 0, 10, 1, 2);
+	IUFillNumberVector(&AdcWeightsNP, AdcWeightsN, ADC_CHANNEL_COUNT, getDeviceName(), "ADC_SCAN_WEIGHTS", "Power ADC scan weights", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&AdcOversampleN[0], "ADC_OVERSAMPLE_COUNT", "Conversions per sample", "%0.0f", 1, ADC_MAX_OVERSAMPLE, 1, 1);
+	IUFillNumberVector(&AdcOversampleNP, AdcOversampleN, 1, getDeviceName(), "ADC_OVERSAMPLE", "Power ADC oversampling", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillSwitch(&AdcFilterS[ADC_FILTER_MEAN], "ADC_FILTER_MEAN", "Mean", ISS_ON);
+	IUFillSwitch(&AdcFilterS[ADC_FILTER_MEDIAN], "ADC_FILTER_MEDIAN", "Median", ISS_OFF);
+	IUFillSwitchVector(&AdcFilterSP, AdcFilterS, 2, getDeviceName(), "ADC_FILTER", "Power ADC filter", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	// calibrated value = ADC volts * gain - offset
+	IUFillNumber(&AdcGainN[ADC_VIN], "ADC_GAIN_VIN", "Vin [V/V]", "%0.4f", 0, 100, 0.01, 6.6);
+	IUFillNumber(&AdcGainN[ADC_VREG], "ADC_GAIN_VREG", "Vreg [V/V]", "%0.4f", 0, 100, 0.01, 6.6);
+	IUFillNumber(&AdcGainN[ADC_ITOT], "ADC_GAIN_ITOT", "Itot [V/V]", "%0.4f", 0, 100, 0.01, 1);
+	IUFillNumber(&AdcGainN[ADC_IREF], "ADC_GAIN_IREF", "Iref [V/V]", "%0.4f", 0, 100, 0.01, 1);
+	IUFillNumber(&AdcGainN[ADC_IREAL], "ADC_GAIN_IREAL", "Ireal [A/V]", "%0.4f", 0, 100, 0.01, (ACS_TYPE == 0) ? 20 : 10.8);
+	IUFillNumberVector(&AdcGainNP, AdcGainN, ADC_CHANNEL_COUNT, getDeviceName(), "ADC_CAL_GAIN", "Power ADC gain", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillNumber(&AdcOffsetN[ADC_VIN], "ADC_OFFSET_VIN", "Vin [V]", "%0.4f", -10, 10, 0.01, 0);
+	IUFillNumber(&AdcOffsetN[ADC_VREG], "ADC_OFFSET_VREG", "Vreg [V]", "%0.4f", -10, 10, 0.01, 0);
+	IUFillNumber(&AdcOffsetN[ADC_ITOT], "ADC_OFFSET_ITOT", "Itot [V]", "%0.4f", -10, 10, 0.01, 0);
+	IUFillNumber(&AdcOffsetN[ADC_IREF], "ADC_OFFSET_IREF", "Iref [V]", "%0.4f", -10, 10, 0.01, 0);
+	IUFillNumber(&AdcOffsetN[ADC_IREAL], "ADC_OFFSET_IREAL", "Ireal [A]", "%0.4f", -10, 10, 0.01, 0);
+	IUFillNumberVector(&AdcOffsetNP, AdcOffsetN, ADC_CHANNEL_COUNT, getDeviceName(), "ADC_CAL_OFFSET", "Power ADC offset", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillSwitch(&AdcZeroS[0], "ADC_ZERO_CURRENT_GO", "Calibrate (all loads off)", ISS_OFF);
+	IUFillSwitchVector(&AdcZeroSP, AdcZeroS, 1, getDeviceName(), "ADC_ZERO_CURRENT", "Zero current", OPTIONS_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
+	IUFillNumber(&AdcChannelsN[ADC_VIN], "ADC_VIN", "Vin [V]", "%0.3f", 0, 30, 0, 0);
+	IUFillNumber(&AdcChannelsN[ADC_VREG], "ADC_VREG", "Vreg [V]", "%0.3f", 0, 30, 0, 0);
+	IUFillNumber(&AdcChannelsN[ADC_ITOT], "ADC_ITOT", "Itot sensor [V]", "%0.4f", -5, 5, 0, 0);
+	IUFillNumber(&AdcChannelsN[ADC_IREF], "ADC_IREF", "Iref sensor [V]", "%0.4f", -5, 5, 0, 0);
+	IUFillNumber(&AdcChannelsN[ADC_IREAL], "ADC_IREAL", "Ireal [A]", "%0.3f", -20, 20, 0, 0);
+	IUFillNumber(&AdcChannelsN[ADC_CHANNEL_COUNT], "ADC_SCAN_RATE", "Samples/s", "%0.1f", 0, 1000, 0, 0);
+	IUFillNumberVector(&AdcChannelsNP, AdcChannelsN, ADC_CHANNEL_COUNT + 1, getDeviceName(), "ADC_CHANNELS", "Power ADC", OUTPUTS_TAB, IP_RO, 60, IPS_IDLE);
+
+	const char *statsWindowNames[STATS_WINDOW_COUNT] = {"POWER_STATS_1MIN", "POWER_STATS_15MIN", "POWER_STATS_1H"};
+	const char *statsWindowLabels[STATS_WINDOW_COUNT] = {"Last minute", "Last 15 minutes", "Last hour"};
+	const char *statsChannelNames[STATS_CHANNEL_COUNT] = {"VIN", "VREG", "ITOT", "PTOT"};
+	const char *statsChannelLabels[STATS_CHANNEL_COUNT] = {"Vin [V]", "Vreg [V]", "Itot [A]", "Ptot [W]"};
+	const char *statsValueNames[STATS_VALUE_COUNT] = {"MIN", "MAX", "MEAN", "RMS"};
+	const double statsChannelMax[STATS_CHANNEL_COUNT] = {30, 30, 20, 300};
+	for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+	{
+		for (int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+		{
+			for (int stat = 0; stat < STATS_VALUE_COUNT; stat++)
+			{
+				char statName[MAXINDINAME], statLabel[MAXINDILABEL];
+				snprintf(statName, MAXINDINAME, "%s_%s", statsChannelNames[channel], statsValueNames[stat]);
+				snprintf(statLabel, MAXINDILABEL, "%s %s", statsChannelLabels[channel], statsValueNames[stat]);
+				IUFillNumber(&PowerStatsN[window][channel * STATS_VALUE_COUNT + stat], statName, statLabel, "%0.3f", -statsChannelMax[channel], statsChannelMax[channel], 0, 0);
+			}
+		}
+		IUFillNumberVector(&PowerStatsNP[window], PowerStatsN[window], STATS_CHANNEL_COUNT * STATS_VALUE_COUNT, getDeviceName(), statsWindowNames[window], statsWindowLabels[window], POWER_STATS_TAB, IP_RO, 60, IPS_IDLE);
+	}
+
+	IUFillSwitch(&PowerStatsResetS[0], "POWER_STATS_RESET_GO", "Reset", ISS_OFF);
+	IUFillSwitchVector(&PowerStatsResetSP, PowerStatsResetS, 1, getDeviceName(), "POWER_STATS_RESET", "Statistics", POWER_STATS_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
+	// power rail capture
+	IUFillNumber(&CaptureSettingsN[CAPTURE_DURATION], "CAPTURE_DURATION", "Window [ms]", "%0.0f", 10, 10000, 10, 500);
+	IUFillNumber(&CaptureSettingsN[CAPTURE_PRETRIGGER], "CAPTURE_PRETRIGGER", "Pre-trigger [%]", "%0.0f", 0, 90, 5, 20);
+	IUFillNumber(&CaptureSettingsN[CAPTURE_LEVEL], "CAPTURE_LEVEL", "Trigger level", "%0.3f", -30, 30, 0.1, 11.5);
+	IUFillNumberVector(&CaptureSettingsNP, CaptureSettingsN, 3, getDeviceName(), "CAPTURE_SETTINGS", "Capture", CAPTURE_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillSwitch(&CaptureChannelS[ADC_VIN], "CAPTURE_VIN", "Vin", ISS_ON);
+	IUFillSwitch(&CaptureChannelS[ADC_VREG], "CAPTURE_VREG", "Vreg", ISS_OFF);
+	IUFillSwitch(&CaptureChannelS[ADC_ITOT], "CAPTURE_ITOT", "Itot sensor", ISS_OFF);
+	IUFillSwitch(&CaptureChannelS[ADC_IREF], "CAPTURE_IREF", "Iref sensor", ISS_OFF);
+	IUFillSwitch(&CaptureChannelS[ADC_IREAL], "CAPTURE_IREAL", "Ireal", ISS_OFF);
+	IUFillSwitchVector(&CaptureChannelSP, CaptureChannelS, ADC_CHANNEL_COUNT, getDeviceName(), "CAPTURE_CHANNEL", "Channel", CAPTURE_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillSwitch(&CaptureTriggerS[CAPTURE_TRIGGER_IMMEDIATE], "TRIGGER_IMMEDIATE", "Immediate", ISS_OFF);
+	IUFillSwitch(&CaptureTriggerS[CAPTURE_TRIGGER_OUTPUT], "TRIGGER_OUTPUT", "Output change", ISS_ON);
+	IUFillSwitch(&CaptureTriggerS[CAPTURE_TRIGGER_RISING], "TRIGGER_RISING", "Rising level", ISS_OFF);
+	IUFillSwitch(&CaptureTriggerS[CAPTURE_TRIGGER_FALLING], "TRIGGER_FALLING", "Falling level", ISS_OFF);
+	IUFillSwitchVector(&CaptureTriggerSP, CaptureTriggerS, CAPTURE_TRIGGER_COUNT, getDeviceName(), "CAPTURE_TRIGGER", "Trigger", CAPTURE_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
+
+	IUFillSwitch(&CaptureS[0], "CAPTURE_ARM", "Arm", ISS_OFF);
+	IUFillSwitch(&CaptureS[1], "CAPTURE_ABORT", "Abort", ISS_OFF);
+	IUFillSwitchVector(&CaptureSP, CaptureS, 2, getDeviceName(), "CAPTURE", "Capture", CAPTURE_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
+	IUFillBLOB(&CaptureB[0], "CAPTURE_WAVEFORM", "Waveform", ".al4cap");
+	IUFillBLOBVector(&CaptureBP, CaptureB, 1, getDeviceName(), "CAPTURE_DATA", "Capture data", CAPTURE_TAB, IP_RO, 60, IPS_IDLE);
+
 	// Environment Group
 	addParameter("WEATHER_TEMPERATURE", "Temperature [C]", -15, 35, 15);
 	addParameter("WEATHER_HUMIDITY", "Humidity %", 0, 100, 15);
@@ -411,47 +883,159 @@ bool AstroLink4Pi::updateProperties()
 
 		defineProperty(&ScopeParametersNP);
 		defineProperty(&FocuserTravelNP);
+		defineProperty(&HomeSwitchNP);
+		defineProperty(&FocusHomeSP);
 		defineProperty(&FocusResolutionSP);
 		defineProperty(&FocusHoldSP);
+		defineProperty(&HoldDecayNP);
+		defineProperty(&MotorThermalNP);
+		defineProperty(&MotorTemperatureNP);
 		defineProperty(&FocuserInfoNP);
+		defineProperty(&CfzPolicySP);
+		defineProperty(&CfzFractionNP);
 		defineProperty(&FocusStepDelayNP);
 		defineProperty(&SysTimeTP);
 		defineProperty(&SysInfoTP);
+		defineProperty(&I2cStatsTP);
 		defineProperty(&Switch1SP);
 		defineProperty(&Switch2SP);
 		defineProperty(&PWM1NP);
 		defineProperty(&PWM2NP);
+		for (int channel = 0; channel < 2; channel++)
+		{
+			defineProperty(&DewControlSP[channel]);
+			defineProperty(&DewSettingsNP[channel]);
+		}
+		defineProperty(&DewStatusNP);
+		defineProperty(&PowerProfileSP);
+		defineProperty(&PwmPhaseSP);
+		defineProperty(&PwmRampNP);
+		if (revision >= 4)
+		{
+			defineProperty(&PwmPeakNP);
+			defineProperty(&BudgetSP);
+			defineProperty(&BudgetSettingsNP);
+			defineProperty(&BudgetStatusNP);
+		}
 		defineProperty(&PWMcycleNP);
 		defineProperty(&StepperCurrentNP);
+		defineProperty(&CurrentProfileNP);
 		defineProperty(&FocusTemperatureNP);
 		defineProperty(&TemperatureCoefNP);
 		defineProperty(&TemperatureCompensateSP);
 		defineProperty(&PowerReadingsNP);
+		if (revision >= 4)
+		{
+			defineProperty(&EnergyCountersNP);
+			defineProperty(&BrownoutStatusNP);
+			defineProperty(&BrownoutSP);
+			defineProperty(&BrownoutSettingsNP);
+			defineProperty(&ShedOrderNP);
+			defineProperty(&LoadModelsNP);
+			defineProperty(&LoadEnergyNP);
+			defineProperty(&BatteryStatusNP);
+			defineProperty(&BatteryTypeSP);
+			defineProperty(&BatterySettingsNP);
+			defineProperty(&EnergyResetSP);
+			defineProperty(&AdcChannelsNP);
+			for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+				defineProperty(&PowerStatsNP[window]);
+			defineProperty(&PowerStatsResetSP);
+			defineProperty(&CaptureSettingsNP);
+			defineProperty(&CaptureChannelSP);
+			defineProperty(&CaptureTriggerSP);
+			defineProperty(&CaptureSP);
+			defineProperty(&CaptureBP);
+			defineProperty(&AdcRateSP);
+			defineProperty(&AdcWeightsNP);
+			defineProperty(&AdcOversampleNP);
+			defineProperty(&AdcFilterSP);
+			defineProperty(&AdcGainNP);
+			defineProperty(&AdcOffsetNP);
+			defineProperty(&AdcZeroSP);
+		}
 		defineProperty(&FanPowerNP);
+		defineProperty(&FanSettingsNP);
 		defineProperty(&SQMOffsetNP);  
+		defineProperty(&SqmSmoothingNP);
+		defineProperty(&SqmStatsNP);
+		defineProperty(&ShtRateSP);
 	}
 	else
 	{
 		deleteProperty(SQMOffsetNP.name);
+		deleteProperty(SqmSmoothingNP.name);
+		deleteProperty(SqmStatsNP.name);
+		deleteProperty(ShtRateSP.name);
 		deleteProperty(ScopeParametersNP.name);
 		deleteProperty(FocuserTravelNP.name);
+		deleteProperty(HomeSwitchNP.name);
+		deleteProperty(FocusHomeSP.name);
 		deleteProperty(FocusResolutionSP.name);
 		deleteProperty(FocusHoldSP.name);
+		deleteProperty(HoldDecayNP.name);
+		deleteProperty(MotorThermalNP.name);
+		deleteProperty(MotorTemperatureNP.name);
 		deleteProperty(FocuserInfoNP.name);
+		deleteProperty(CfzPolicySP.name);
+		deleteProperty(CfzFractionNP.name);
 		deleteProperty(FocusStepDelayNP.name);
 		deleteProperty(FocusTemperatureNP.name);
 		deleteProperty(TemperatureCoefNP.name);
 		deleteProperty(TemperatureCompensateSP.name);
 		deleteProperty(SysTimeTP.name);
 		deleteProperty(SysInfoTP.name);
+		deleteProperty(I2cStatsTP.name);
 		deleteProperty(Switch1SP.name);
 		deleteProperty(Switch2SP.name);
 		deleteProperty(PWM1NP.name);
 		deleteProperty(PWM2NP.name);
+		for (int channel = 0; channel < 2; channel++)
+		{
+			deleteProperty(DewControlSP[channel].name);
+			deleteProperty(DewSettingsNP[channel].name);
+		}
+		deleteProperty(DewStatusNP.name);
+		deleteProperty(PowerProfileSP.name);
+		deleteProperty(PwmPhaseSP.name);
+		deleteProperty(PwmRampNP.name);
+		deleteProperty(PwmPeakNP.name);
+		deleteProperty(BudgetSP.name);
+		deleteProperty(BudgetSettingsNP.name);
+		deleteProperty(BudgetStatusNP.name);
 		deleteProperty(PWMcycleNP.name);
 		deleteProperty(StepperCurrentNP.name);
+		deleteProperty(CurrentProfileNP.name);
 		deleteProperty(PowerReadingsNP.name);
+		deleteProperty(EnergyCountersNP.name);
+		deleteProperty(BrownoutStatusNP.name);
+		deleteProperty(BrownoutSP.name);
+		deleteProperty(BrownoutSettingsNP.name);
+		deleteProperty(ShedOrderNP.name);
+		deleteProperty(LoadModelsNP.name);
+		deleteProperty(LoadEnergyNP.name);
+		deleteProperty(BatteryStatusNP.name);
+		deleteProperty(BatteryTypeSP.name);
+		deleteProperty(BatterySettingsNP.name);
+		deleteProperty(EnergyResetSP.name);
+		deleteProperty(AdcChannelsNP.name);
+		for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+			deleteProperty(PowerStatsNP[window].name);
+		deleteProperty(PowerStatsResetSP.name);
+		deleteProperty(CaptureSettingsNP.name);
+		deleteProperty(CaptureChannelSP.name);
+		deleteProperty(CaptureTriggerSP.name);
+		deleteProperty(CaptureSP.name);
+		deleteProperty(CaptureBP.name);
+		deleteProperty(AdcRateSP.name);
+		deleteProperty(AdcWeightsNP.name);
+		deleteProperty(AdcOversampleNP.name);
+		deleteProperty(AdcFilterSP.name);
+		deleteProperty(AdcGainNP.name);
+		deleteProperty(AdcOffsetNP.name);
+		deleteProperty(AdcZeroSP.name);
 		deleteProperty(FanPowerNP.name);
+		deleteProperty(FanSettingsNP.name);
 		FI::updateProperties();
 		WI::updateProperties();
 	}
@@ -524,14 +1108,41 @@ bool AstroLink4Pi::ISNewNumber(const char *dev, const char *name, double values[
 			return true;
 		}
 
+		// handle CFZ quantum
+		if (!strcmp(name, CfzFractionNP.name))
+		{
+			IUUpdateNumber(&CfzFractionNP, values, names, n);
+			CfzFractionNP.s = IPS_OK;
+			IDSetNumber(&CfzFractionNP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Focuser moves quantized to %0.2f of CFZ (%0.1f steps)", CfzFractionN[0].value, CfzFractionN[0].value * FocuserInfoN[FOC_STEPS_CFZ].value);
+			return true;
+		}
+
+		// handle home switch settings
+		if (!strcmp(name, HomeSwitchNP.name))
+		{
+			IUUpdateNumber(&HomeSwitchNP, values, names, n);
+			HomeSwitchNP.s = IPS_OK;
+			if (isConnected() && (int)HomeSwitchN[HOME_GPIO].value != homeGpio)
+				HomeSwitchNP.s = claimHomeSwitch((int)HomeSwitchN[HOME_GPIO].value) ? IPS_OK : IPS_ALERT;
+			IDSetNumber(&HomeSwitchNP, nullptr);
+			return true;
+		}
+
 		// handle PWMouts
 		if (!strcmp(name, PWM1NP.name))
 		{
 			IUUpdateNumber(&PWM1NP, values, names, n);
+			if (DewControlS[0][DEW_AUTO].s == ISS_ON)
+			{
+				IUResetSwitch(&DewControlSP[0]);
+				DewControlS[0][DEW_MANUAL].s = ISS_ON;
+				IDSetSwitch(&DewControlSP[0], nullptr);
+				DEBUG(INDI::Logger::DBG_SESSION, "PWM 1 dew heater control switched to manual");
+			}
 			PWM1NP.s = IPS_OK;
 			IDSetNumber(&PWM1NP, nullptr);
-			lgTxPwm(pigpioHandle, PWM1_PIN, PWMcycleN[0].value, PWM1N[0].value, 0, 0);
-			pwmState[0] = PWM1N[0].value;
+			setPwmOutput(0, PWM1N[0].value);
 			DEBUGF(INDI::Logger::DBG_SESSION, "PWM 1 set to %0.0f", PWM1N[0].value);
 			return true;
 		}
@@ -539,10 +1150,16 @@ bool AstroLink4Pi::ISNewNumber(const char *dev, const char *name, double values[
 		if (!strcmp(name, PWM2NP.name))
 		{
 			IUUpdateNumber(&PWM2NP, values, names, n);
+			if (DewControlS[1][DEW_AUTO].s == ISS_ON)
+			{
+				IUResetSwitch(&DewControlSP[1]);
+				DewControlS[1][DEW_MANUAL].s = ISS_ON;
+				IDSetSwitch(&DewControlSP[1], nullptr);
+				DEBUG(INDI::Logger::DBG_SESSION, "PWM 2 dew heater control switched to manual");
+			}
 			PWM2NP.s = IPS_OK;
 			IDSetNumber(&PWM2NP, nullptr);
-			lgTxPwm(pigpioHandle, PWM2_PIN, PWMcycleN[0].value, PWM2N[0].value, 0, 0);
-			pwmState[1] = PWM2N[0].value;
+			setPwmOutput(1, PWM2N[0].value);
 			DEBUGF(INDI::Logger::DBG_SESSION, "PWM 2 set to %0.0f", PWM2N[0].value);
 			return true;
 		}
@@ -552,19 +1169,142 @@ bool AstroLink4Pi::ISNewNumber(const char *dev, const char *name, double values[
         {
             SQMOffsetNP.s = IPS_BUSY;
             IUUpdateNumber(&SQMOffsetNP, values, names, n);
+            sqmOffset = SQMOffsetN[0].value;
             SQMOffsetNP.s = IPS_OK;
             IDSetNumber(&SQMOffsetNP, nullptr);
             return true;
         }    		
 
+		// power ADC scan weights
+		if (!strcmp(name, AdcWeightsNP.name))
+		{
+			IUUpdateNumber(&AdcWeightsNP, values, names, n);
+			for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+				adcWeights[channel] = (int)AdcWeightsN[channel].value;
+			powerScanChanged = true;
+			AdcWeightsNP.s = IPS_OK;
+			IDSetNumber(&AdcWeightsNP, nullptr);
+			return true;
+		}
+
+		// load shedding limits and order
+		if (!strcmp(name, BrownoutSettingsNP.name) || !strcmp(name, ShedOrderNP.name))
+		{
+			INumberVectorProperty *property = !strcmp(name, ShedOrderNP.name) ? &ShedOrderNP : &BrownoutSettingsNP;
+			IUUpdateNumber(property, values, names, n);
+			configureBrownout();
+			property->s = IPS_OK;
+			IDSetNumber(property, nullptr);
+			return true;
+		}
+
+		// power budget limits
+		if (!strcmp(name, BudgetSettingsNP.name))
+		{
+			IUUpdateNumber(&BudgetSettingsNP, values, names, n);
+			configureBudget();
+			BudgetSettingsNP.s = IPS_OK;
+			IDSetNumber(&BudgetSettingsNP, nullptr);
+			return true;
+		}
+
+		// fan controller
+		if (!strcmp(name, FanSettingsNP.name))
+		{
+			IUUpdateNumber(&FanSettingsNP, values, names, n);
+			configureFan();
+			FanSettingsNP.s = IPS_OK;
+			IDSetNumber(&FanSettingsNP, nullptr);
+			return true;
+		}
+
+		// battery settings
+		if (!strcmp(name, BatterySettingsNP.name))
+		{
+			IUUpdateNumber(&BatterySettingsNP, values, names, n);
+			configureBattery();
+			BatterySettingsNP.s = IPS_OK;
+			IDSetNumber(&BatterySettingsNP, nullptr);
+			return true;
+		}
+
+		// PWM soft start, a ramp in progress continues at the new rate
+		if (!strcmp(name, PwmRampNP.name))
+		{
+			IUUpdateNumber(&PwmRampNP, values, names, n);
+			pwmRampRate[0] = PwmRampN[0].value;
+			pwmRampRate[1] = PwmRampN[1].value;
+			PwmRampNP.s = IPS_OK;
+			IDSetNumber(&PwmRampNP, nullptr);
+			return true;
+		}
+
+		// dew heater models
+		for (int channel = 0; channel < 2; channel++)
+		{
+			if (!strcmp(name, DewSettingsNP[channel].name))
+			{
+				IUUpdateNumber(&DewSettingsNP[channel], values, names, n);
+				configureDewHeater(channel);
+				DewSettingsNP[channel].s = IPS_OK;
+				IDSetNumber(&DewSettingsNP[channel], nullptr);
+				return true;
+			}
+		}
+
+		// capture settings
+		if (!strcmp(name, CaptureSettingsNP.name))
+		{
+			IUUpdateNumber(&CaptureSettingsNP, values, names, n);
+			CaptureSettingsNP.s = IPS_OK;
+			IDSetNumber(&CaptureSettingsNP, nullptr);
+			return true;
+		}
+
+		// power ADC oversampling
+		if (!strcmp(name, AdcOversampleNP.name))
+		{
+			IUUpdateNumber(&AdcOversampleNP, values, names, n);
+			adcOversample = (int)AdcOversampleN[0].value;
+			AdcOversampleNP.s = IPS_OK;
+			IDSetNumber(&AdcOversampleNP, nullptr);
+			return true;
+		}
+
+		// power ADC calibration
+		if (!strcmp(name, AdcGainNP.name) || !strcmp(name, AdcOffsetNP.name))
+		{
+			INumberVectorProperty *property = !strcmp(name, AdcGainNP.name) ? &AdcGainNP : &AdcOffsetNP;
+			IUUpdateNumber(property, values, names, n);
+			for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+			{
+				adcGain[channel] = AdcGainN[channel].value;
+				adcOffset[channel] = AdcOffsetN[channel].value;
+			}
+			property->s = IPS_OK;
+			IDSetNumber(property, nullptr);
+			return true;
+		}
+
+		// SQM estimator time constant
+		if (!strcmp(name, SqmSmoothingNP.name))
+		{
+			IUUpdateNumber(&SqmSmoothingNP, values, names, n);
+			sqmTimeConstant = SqmSmoothingN[0].value;
+			SqmSmoothingNP.s = IPS_OK;
+			IDSetNumber(&SqmSmoothingNP, nullptr);
+			return true;
+		}
+
 		// handle PWMcycle
 		if (!strcmp(name, PWMcycleNP.name))
 		{
 			IUUpdateNumber(&PWMcycleNP, values, names, n);
 			PWMcycleNP.s = IPS_OK;
 			IDSetNumber(&PWMcycleNP, nullptr);
-			lgTxPwm(pigpioHandle, PWM1_PIN, PWMcycleN[0].value, PWM1N[0].value, 0, 0);
-			lgTxPwm(pigpioHandle, PWM2_PIN, PWMcycleN[0].value, PWM1N[0].value, 0, 0);
+			pwmFrequency = PWMcycleN[0].value;
+			setPwmOutput(0, PWM1N[0].value);
+			setPwmOutput(1, PWM2N[0].value);
 			DEBUGF(INDI::Logger::DBG_SESSION, "PWM frequency set to %0.0f Hz", PWMcycleN[0].value);
 			return true;
 		}
@@ -580,6 +1320,35 @@ bool AstroLink4Pi::ISNewNumber(const char *dev, const char *name, double values[
 			return true;
 		}
 
+		// handle idle hold reduction
+		if (!strcmp(name, HoldDecayNP.name))
+		{
+			IUUpdateNumber(&HoldDecayNP, values, names, n);
+			HoldDecayNP.s = IPS_OK;
+			IDSetNumber(&HoldDecayNP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Hold power reduced to %0.0f%% after %0.0f s idle", HoldDecayN[HOLD_DECAY_LEVEL].value, HoldDecayN[HOLD_DECAY_TIME].value);
+			return true;
+		}
+
+		// handle motor thermal model
+		if (!strcmp(name, MotorThermalNP.name))
+		{
+			IUUpdateNumber(&MotorThermalNP, values, names, n);
+			MotorThermalNP.s = IPS_OK;
+			IDSetNumber(&MotorThermalNP, nullptr);
+			return true;
+		}
+
+		// handle stepper current profile
+		if (!strcmp(name, CurrentProfileNP.name))
+		{
+			IUUpdateNumber(&CurrentProfileNP, values, names, n);
+			CurrentProfileNP.s = IPS_OK;
+			IDSetNumber(&CurrentProfileNP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Stepper current profile set to %0.0f%% / %0.0f%% with %0.0f acceleration steps", CurrentProfileN[PROFILE_BOOST].value, CurrentProfileN[PROFILE_CRUISE].value, CurrentProfileN[PROFILE_RAMP].value);
+			return true;
+		}
+
 		if (strstr(name, "FOCUS_"))
 			return FI::processNumber(dev, name, values, names, n);
 		if (strstr(name, "WEATHER_"))
@@ -624,7 +1393,7 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 
 			if (Switch1S[S1_ON].s == ISS_ON)
 			{
-				rv = lgGpioWrite(pigpioHandle, OUT1_PIN, 1);
+				rv = setRelayOutput(0, 1);
 				if (rv != 0)
 				{
 					DEBUG(INDI::Logger::DBG_ERROR, "Error setting AstroLink Relay #1");
@@ -633,7 +1402,6 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 					IDSetSwitch(&Switch1SP, NULL);
 					return false;
 				}
-				relayState[0] = 1;
 				DEBUG(INDI::Logger::DBG_SESSION, "AstroLink Relays #1 set to ON");
 				Switch1SP.s = IPS_OK;
 				Switch1S[S1_OFF].s = ISS_OFF;
@@ -642,7 +1410,7 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 			}
 			if (Switch1S[S1_OFF].s == ISS_ON)
 			{
-				rv = lgGpioWrite(pigpioHandle, OUT1_PIN, 0);
+				rv = setRelayOutput(0, 0);
 				if (rv != 0)
 				{
 					DEBUG(INDI::Logger::DBG_ERROR, "Error setting AstroLink Relay #1");
@@ -651,7 +1419,6 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 					IDSetSwitch(&Switch1SP, NULL);
 					return false;
 				}
-				relayState[0] = 0;
 				DEBUG(INDI::Logger::DBG_SESSION, "AstroLink Relays #1 set to OFF");
 				Switch1SP.s = IPS_IDLE;
 				Switch1S[S1_ON].s = ISS_OFF;
@@ -667,7 +1434,7 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 
 			if (Switch2S[S2_ON].s == ISS_ON)
 			{
-				rv = lgGpioWrite(pigpioHandle, OUT2_PIN, 1);
+				rv = setRelayOutput(1, 1);
 				if (rv != 0)
 				{
 					DEBUG(INDI::Logger::DBG_ERROR, "Error setting AstroLink Relay #2");
@@ -676,7 +1443,6 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 					IDSetSwitch(&Switch2SP, NULL);
 					return false;
 				}
-				relayState[1] = 1;
 				DEBUG(INDI::Logger::DBG_SESSION, "AstroLink Relays #2 set to ON");
 				Switch2SP.s = IPS_OK;
 				Switch2S[S2_OFF].s = ISS_OFF;
@@ -685,7 +1451,7 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 			}
 			if (Switch2S[S2_OFF].s == ISS_ON)
 			{
-				rv = lgGpioWrite(pigpioHandle, OUT2_PIN, 0);
+				rv = setRelayOutput(1, 0);
 				if (rv != 0)
 				{
 					DEBUG(INDI::Logger::DBG_ERROR, "Error setting AstroLink Relay #2");
@@ -694,7 +1460,6 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 					IDSetSwitch(&Switch2SP, NULL);
 					return false;
 				}
-				relayState[1] = 0;
 				DEBUG(INDI::Logger::DBG_SESSION, "AstroLink Relays #2 set to OFF");
 				Switch2SP.s = IPS_IDLE;
 				Switch2S[S2_ON].s = ISS_OFF;
@@ -713,6 +1478,256 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 			return true;
 		}
 
+		// handle power ADC rate
+		if (!strcmp(name, AdcRateSP.name))
+		{
+			IUUpdateSwitch(&AdcRateSP, states, names, n);
+			adcRate = IUFindOnSwitchIndex(&AdcRateSP);
+			powerScanChanged = true;
+			AdcRateSP.s = IPS_OK;
+			IDSetSwitch(&AdcRateSP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Power ADC rate set to %s", AdcRateS[adcRate].label);
+			return true;
+		}
+
+		// load shedding
+		if (!strcmp(name, BrownoutSP.name))
+		{
+			IUUpdateSwitch(&BrownoutSP, states, names, n);
+			configureBrownout();
+			BrownoutSP.s = brownoutEnabled ? IPS_OK : IPS_IDLE;
+			IDSetSwitch(&BrownoutSP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Load shedding %s", brownoutEnabled ? "enabled" : "disabled");
+			return true;
+		}
+
+		if (!strcmp(name, BudgetSP.name))
+		{
+			IUUpdateSwitch(&BudgetSP, states, names, n);
+			configureBudget();
+			BudgetSP.s = (BudgetS[0].s == ISS_ON) ? IPS_OK : IPS_IDLE;
+			IDSetSwitch(&BudgetSP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Power budget %s", (BudgetS[0].s == ISS_ON) ? "enabled" : "disabled");
+			return true;
+		}
+
+		// battery chemistry
+		if (!strcmp(name, BatteryTypeSP.name))
+		{
+			IUUpdateSwitch(&BatteryTypeSP, states, names, n);
+			configureBattery();
+			BatteryTypeSP.s = IPS_OK;
+			IDSetSwitch(&BatteryTypeSP, nullptr);
+			return true;
+		}
+
+		// energy counters reset
+		if (!strcmp(name, EnergyResetSP.name))
+		{
+			IUUpdateSwitch(&EnergyResetSP, states, names, n);
+			int index = IUFindOnSwitchIndex(&EnergyResetSP);
+			if (index >= 0)
+			{
+				energyReset |= (index == 0) ? ENERGY_RESET_SESSION : ENERGY_RESET_LIFETIME;
+				DEBUGF(INDI::Logger::DBG_SESSION, "%s energy counters reset", (index == 0) ? "Session" : "Lifetime");
+			}
+			IUResetSwitch(&EnergyResetSP);
+			EnergyResetSP.s = IPS_OK;
+			IDSetSwitch(&EnergyResetSP, nullptr);
+			return true;
+		}
+
+		// dew heater control mode
+		for (int channel = 0; channel < 2; channel++)
+		{
+			if (!strcmp(name, DewControlSP[channel].name))
+			{
+				IUUpdateSwitch(&DewControlSP[channel], states, names, n);
+				dewControl[channel].reset();
+				DewControlSP[channel].s = IPS_OK;
+				IDSetSwitch(&DewControlSP[channel], nullptr);
+				DEBUGF(INDI::Logger::DBG_SESSION, "PWM %d dew heater control %s", channel + 1, (DewControlS[channel][DEW_AUTO].s == ISS_ON) ? "follows dew point" : "manual");
+				return true;
+			}
+		}
+
+		// run or abort a power profile
+		if (!strcmp(name, PowerProfileSP.name))
+		{
+			IUUpdateSwitch(&PowerProfileSP, states, names, n);
+			int profile = IUFindOnSwitchIndex(&PowerProfileSP);
+			IUResetSwitch(&PowerProfileSP);
+			if (profile == PROFILE_COUNT)
+			{
+				stopProfileThread();
+				profileUpdate();
+				PowerProfileSP.s = IPS_IDLE;
+				DEBUG(INDI::Logger::DBG_SESSION, "Power profile aborted");
+			}
+			else if (profile >= 0)
+			{
+				PowerProfileSP.s = startProfile(profile) ? IPS_BUSY : IPS_ALERT;
+				if (PowerProfileSP.s == IPS_BUSY)
+					PowerProfileS[profile].s = ISS_ON;
+			}
+			IDSetSwitch(&PowerProfileSP, nullptr);
+			return true;
+		}
+
+		// PWM phase mode
+		if (!strcmp(name, PwmPhaseSP.name))
+		{
+			IUUpdateSwitch(&PwmPhaseSP, states, names, n);
+			pwmInterleaved = (PwmPhaseS[PWM_INTERLEAVED].s == ISS_ON);
+			{
+				std::lock_guard<std::mutex> lock(outputMutex);
+				applyPwmOutputs();
+			}
+			PwmPhaseSP.s = IPS_OK;
+			IDSetSwitch(&PwmPhaseSP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "PWM outputs %s", pwmInterleaved ? "interleaved" : "aligned");
+			return true;
+		}
+
+		// capture channel and trigger apply at the next arm
+		if (!strcmp(name, CaptureChannelSP.name) || !strcmp(name, CaptureTriggerSP.name))
+		{
+			ISwitchVectorProperty *property = !strcmp(name, CaptureChannelSP.name) ? &CaptureChannelSP : &CaptureTriggerSP;
+			IUUpdateSwitch(property, states, names, n);
+			property->s = IPS_OK;
+			IDSetSwitch(property, nullptr);
+			return true;
+		}
+
+		// arm or abort the capture, the power thread switches to the captured channel while armed
+		if (!strcmp(name, CaptureSP.name))
+		{
+			IUUpdateSwitch(&CaptureSP, states, names, n);
+			int action = IUFindOnSwitchIndex(&CaptureSP);
+			IUResetSwitch(&CaptureSP);
+			if (revision < 4 || action < 0)
+				return true;
+
+			std::lock_guard<std::mutex> lock(captureMutex);
+			if (action == 0)
+			{
+				int channel = std::max(IUFindOnSwitchIndex(&CaptureChannelSP), 0);
+				int trigger = std::max(IUFindOnSwitchIndex(&CaptureTriggerSP), 0);
+				size_t samples = CaptureSettingsN[CAPTURE_DURATION].value * adcRates[ADC_RATE_COUNT - 1] / 1000;
+				size_t preSamples = samples * CaptureSettingsN[CAPTURE_PRETRIGGER].value / 100;
+				capture.arm(channel, trigger, CaptureSettingsN[CAPTURE_LEVEL].value, samples, preSamples);
+				capturePhaseSince = pwmPhaseSince;
+				captureEvent = 0;
+				captureDone = false;
+				captureActive = true;
+				CaptureS[0].s = ISS_ON;
+				CaptureSP.s = IPS_BUSY;
+				DEBUGF(INDI::Logger::DBG_SESSION, "Capture of %s armed, %0.0f ms window", CaptureChannelS[channel].label, CaptureSettingsN[CAPTURE_DURATION].value);
+			}
+			else
+			{
+				capture.abort();
+				if (captureActive.exchange(false))
+					powerScanChanged = true;
+				CaptureSP.s = IPS_IDLE;
+				DEBUG(INDI::Logger::DBG_SESSION, "Capture aborted");
+			}
+			IDSetSwitch(&CaptureSP, nullptr);
+			return true;
+		}
+
+		// power statistics reset
+		if (!strcmp(name, PowerStatsResetSP.name))
+		{
+			powerStatsReset = true;
+			DEBUG(INDI::Logger::DBG_SESSION, "Power statistics reset");
+			IUResetSwitch(&PowerStatsResetSP);
+			PowerStatsResetSP.s = IPS_OK;
+			IDSetSwitch(&PowerStatsResetSP, nullptr);
+			return true;
+		}
+
+		// handle power ADC filter
+		if (!strcmp(name, AdcFilterSP.name))
+		{
+			IUUpdateSwitch(&AdcFilterSP, states, names, n);
+			adcFilterMode = IUFindOnSwitchIndex(&AdcFilterSP);
+			AdcFilterSP.s = IPS_OK;
+			IDSetSwitch(&AdcFilterSP, nullptr);
+			return true;
+		}
+
+		// zero current calibration, finished by the power thread
+		if (!strcmp(name, AdcZeroSP.name))
+		{
+			if (revision < 4 || AdcZeroSP.s == IPS_BUSY)
+				return true;
+
+			IUUpdateSwitch(&AdcZeroSP, states, names, n);
+			zeroRequest = true;
+			powerScanChanged = true;
+			AdcZeroSP.s = IPS_BUSY;
+			IDSetSwitch(&AdcZeroSP, nullptr);
+			DEBUG(INDI::Logger::DBG_SESSION, "Zero current calibration started. Keep all loads switched off.");
+			return true;
+		}
+
+		// handle SHT measurement rate
+		if (!strcmp(name, ShtRateSP.name))
+		{
+			IUUpdateSwitch(&ShtRateSP, states, names, n);
+			shtRate = IUFindOnSwitchIndex(&ShtRateSP);
+			ShtRateSP.s = IPS_OK;
+			IDSetSwitch(&ShtRateSP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "Humidity sensor rate set to %s", ShtRateS[shtRate].label);
+			return true;
+		}
+
+		// handle CFZ quantization
+		if (!strcmp(name, CfzPolicySP.name))
+		{
+			IUUpdateSwitch(&CfzPolicySP, states, names, n);
+			cfzPendingTarget = -1;
+			CfzPolicySP.s = (CfzPolicyS[CFZ_POLICY_ON].s == ISS_ON) ? IPS_OK : IPS_IDLE;
+			IDSetSwitch(&CfzPolicySP, nullptr);
+			DEBUGF(INDI::Logger::DBG_SESSION, "CFZ move quantization %s.", (CfzPolicyS[CFZ_POLICY_ON].s == ISS_ON) ? "ENABLED" : "DISABLED");
+			return true;
+		}
+
+		// handle homing
+		if (!strcmp(name, FocusHomeSP.name))
+		{
+			IUUpdateSwitch(&FocusHomeSP, states, names, n);
+			if (FocusHomeS[0].s != ISS_ON)
+				return true;
+
+			if (homeGpio <= 0)
+			{
+				DEBUG(INDI::Logger::DBG_WARNING, "Home switch GPIO is not configured.");
+				FocusHomeS[0].s = ISS_OFF;
+				FocusHomeSP.s = IPS_ALERT;
+				IDSetSwitch(&FocusHomeSP, nullptr);
+				return false;
+			}
+
+			if (_motionThread.joinable())
+			{
+				_abort = true;
+				_motionThread.join();
+			}
+
+			FocusHomeSP.s = IPS_BUSY;
+			IDSetSwitch(&FocusHomeSP, nullptr);
+			FocusAbsPosNP.setState(IPS_BUSY);
+			FocusAbsPosNP.apply();
+			_abort = false;
+			setCurrent(false);
+
+			DEBUG(INDI::Logger::DBG_SESSION, "Focuser homing started.");
+			_motionThread = getHomingThread();
+			return true;
+		}
+
 		// handle focus resolution
 		if (!strcmp(name, FocusResolutionSP.name))
 		{
@@ -757,7 +1772,7 @@ bool AstroLink4Pi::ISNewSwitch(const char *dev, const char *name, ISState *state
 					position_adjustment = last_resolution - position_adjustment;
 				}
 				DEBUGF(INDI::Logger::DBG_SESSION, "Focuser position adjusted by %d steps at 1/%d resolution to sync with 1/%d resolution.", position_adjustment, last_resolution, resolution);
-				MoveAbsFocuser(FocusAbsPosNP[0].getValue() + position_adjustment);
+				moveFocuser(FocusAbsPosNP[0].getValue() + position_adjustment);
 			}
 
 			SetResolution(resolution);
@@ -821,6 +1836,27 @@ bool AstroLink4Pi::ISNewText(const char *dev, const char *name, char *texts[], c
 
 			return true;
 		}
+
+		// power profiles are checked when set, so a typo does not wait for the next connect
+		if (!strcmp(name, PowerProfilesTP.name))
+		{
+			for (int i = 0; i < n; i++)
+			{
+				std::vector<ProfileStep> steps;
+				std::string error;
+				if (!parsePowerProfile(texts[i], steps, error))
+				{
+					DEBUGF(INDI::Logger::DBG_ERROR, "Power profile %s: %s", names[i], error.c_str());
+					PowerProfilesTP.s = IPS_ALERT;
+					IDSetText(&PowerProfilesTP, nullptr);
+					return false;
+				}
+			}
+			IUUpdateText(&PowerProfilesTP, texts, names, n);
+			PowerProfilesTP.s = IPS_OK;
+			IDSetText(&PowerProfilesTP, nullptr);
+			return true;
+		}
 	}
 
 	return INDI::DefaultDevice::ISNewText(dev, name, texts, names, n);
@@ -832,19 +1868,52 @@ bool AstroLink4Pi::saveConfigItems(FILE *fp)
 	WI::saveConfigItems(fp);
 	IUSaveConfigSwitch(fp, &FocusResolutionSP);
 	IUSaveConfigSwitch(fp, &FocusHoldSP);
+	IUSaveConfigNumber(fp, &HoldDecayNP);
+	IUSaveConfigNumber(fp, &MotorThermalNP);
 	IUSaveConfigSwitch(fp, &TemperatureCompensateSP);
 	IUSaveConfigNumber(fp, &FocusStepDelayNP);
 	IUSaveConfigNumber(fp, &FocuserTravelNP);
+	IUSaveConfigSwitch(fp, &CfzPolicySP);
+	IUSaveConfigNumber(fp, &CfzFractionNP);
+	IUSaveConfigNumber(fp, &HomeSwitchNP);
 	IUSaveConfigNumber(fp, &ScopeParametersNP);
 	IUSaveConfigNumber(fp, &TemperatureCoefNP);
 	IUSaveConfigNumber(fp, &PWMcycleNP);
 	IUSaveConfigText(fp, &RelayLabelsTP);
+	IUSaveConfigText(fp, &PowerProfilesTP);
 	IUSaveConfigSwitch(fp, &Switch1SP);
 	IUSaveConfigSwitch(fp, &Switch2SP);
 	IUSaveConfigNumber(fp, &StepperCurrentNP);
+	IUSaveConfigNumber(fp, &CurrentProfileNP);
 	IUSaveConfigNumber(fp, &PWM1NP);
 	IUSaveConfigNumber(fp, &PWM2NP);
 	IUSaveConfigNumber(fp, &SQMOffsetNP);
+	IUSaveConfigNumber(fp, &SqmSmoothingNP);
+	IUSaveConfigSwitch(fp, &AdcRateSP);
+	IUSaveConfigNumber(fp, &AdcWeightsNP);
+	IUSaveConfigNumber(fp, &AdcOversampleNP);
+	IUSaveConfigSwitch(fp, &AdcFilterSP);
+	IUSaveConfigNumber(fp, &AdcGainNP);
+	IUSaveConfigNumber(fp, &AdcOffsetNP);
+	IUSaveConfigNumber(fp, &CaptureSettingsNP);
+	IUSaveConfigSwitch(fp, &PwmPhaseSP);
+	IUSaveConfigNumber(fp, &PwmRampNP);
+	IUSaveConfigNumber(fp, &FanSettingsNP);
+	IUSaveConfigSwitch(fp, &BudgetSP);
+	IUSaveConfigNumber(fp, &BudgetSettingsNP);
+	for (int channel = 0; channel < 2; channel++)
+	{
+		IUSaveConfigSwitch(fp, &DewControlSP[channel]);
+		IUSaveConfigNumber(fp, &DewSettingsNP[channel]);
+	}
+	IUSaveConfigSwitch(fp, &CaptureChannelSP);
+	IUSaveConfigSwitch(fp, &CaptureTriggerSP);
+	IUSaveConfigSwitch(fp, &BatteryTypeSP);
+	IUSaveConfigSwitch(fp, &BrownoutSP);
+	IUSaveConfigNumber(fp, &BrownoutSettingsNP);
+	IUSaveConfigNumber(fp, &ShedOrderNP);
+	IUSaveConfigNumber(fp, &BatterySettingsNP);
+	IUSaveConfigSwitch(fp, &ShtRateSP);
 
 	return true;
 }
@@ -854,19 +1923,65 @@ void AstroLink4Pi::TimerHit()
 	if (!isConnected())
 		return;
 
+	uint64_t tickStart = monotonicNs();
 	long int timeMillis = millis();
-	SQMavailable = readSQM(nextTemperatureRead < timeMillis);
 
-	if (nextTemperatureRead < timeMillis)
+	// sensors are read by the acquisition thread, only publish its latest snapshot here
+	SensorSnapshot sample;
+	if (sensorSnapshot.read(sample))
+	{
+		publishSensors(sample);
+		if (revision >= 4)
+			budgetUpdate(sample);
+	}
+
+	profileUpdate();
+
+	// a deferred move never reached its target, it is reported idle and stays pending
+	if (cfzDeferred)
+	{
+		cfzDeferred = false;
+		FocusAbsPosNP.setState(IPS_IDLE);
+		FocusAbsPosNP.apply();
+		FocusRelPosNP.setState(IPS_IDLE);
+		FocusRelPosNP.apply();
+	}
+
+	if (timeMillis - lastDewUpdate >= DEW_CONTROL_PERIOD)
+		dewUpdate(timeMillis);
+
+	if (revision >= 4)
 	{
-		SHTavailable = readSHT();
-		MLXavailable = readMLX();
+		brownoutUpdate();
+		publishPowerStats();
+		captureUpdate();
+		if (timeMillis >= nextLoadUpdate)
+		{
+			loadEnergyUpdate();
+			nextLoadUpdate = timeMillis + LOAD_ENERGY_PERIOD;
+		}
+	}
+
+	if (zeroDone.exchange(false))
+	{
+		AdcOffsetN[ADC_IREAL].value = zeroOffset;
+		adcOffset[ADC_IREAL] = zeroOffset.load();
+		AdcOffsetNP.s = IPS_OK;
+		IDSetNumber(&AdcOffsetNP, nullptr);
+		IUResetSwitch(&AdcZeroSP);
+		AdcZeroSP.s = IPS_OK;
+		IDSetSwitch(&AdcZeroSP, nullptr);
+		saveConfig(true, AdcOffsetNP.name);
+		DEBUGF(INDI::Logger::DBG_SESSION, "Zero current offset set to %0.4f A", zeroOffset.load());
+	}
 
+	if (nextTemperatureRead < timeMillis)
+	{
 		nextTemperatureRead = timeMillis + TEMPERATURE_UPDATE_TIMEOUT;
 
-		if (SHTavailable || MLXavailable)
+		if (lastSample.shtValid || lastSample.mlxValid)
 		{
-			FocusTemperatureN[0].value = focuserTemperature;
+			FocusTemperatureN[0].value = lastSample.shtValid ? lastSample.temperature : lastSample.ambientTemperature;
 			FocusTemperatureNP.s = IPS_OK;
 		}
 		else
@@ -882,20 +1997,40 @@ void AstroLink4Pi::TimerHit()
 		temperatureCompensation();
 		nextTemperatureCompensation = timeMillis + TEMPERATURE_COMPENSATION_TIMEOUT;
 	}
+	if (revision >= 4 && nextEnergyCheckpoint < timeMillis)
+	{
+		saveEnergy();
+		nextEnergyCheckpoint = timeMillis + ENERGY_CHECKPOINT_PERIOD;
+	}
 	if (nextSystemRead < timeMillis)
 	{
 		systemUpdate();
 		nextSystemRead = timeMillis + SYSTEM_UPDATE_PERIOD;
 	}
-	if (nextFanUpdate < timeMillis)
+	if (nextFanUpdate <= timeMillis)
+	{
+		fanUpdate(timeMillis);
+		nextFanUpdate = timeMillis + (long int)(FanSettingsN[FAN_RATE].value * 1000);
+	}
+	if (nextHoldUpdate < timeMillis)
 	{
-		fanUpdate();
-		nextFanUpdate = timeMillis + FAN_PERIOD;
+		holdUpdate(timeMillis);
+		nextHoldUpdate = timeMillis + HOLD_UPDATE_PERIOD;
+	}
+	if (nextI2cStats < timeMillis)
+	{
+		i2cStatsUpdate();
+		nextI2cStats = timeMillis + I2C_STATS_PERIOD;
 	}
-	readPower();
 
-	SetTimer(POLL_PERIOD);
-}
+	double tickTime = (monotonicNs() - tickStart) / 1e6;
+	if (tickTime > 1.0)
+	{
+		DEBUGF(INDI::Logger::DBG_DEBUG, "Main loop blocked for %0.2f ms.", tickTime);
+	}
+
+	SetTimer(POLL_PERIOD);
+}
 
 bool AstroLink4Pi::AbortFocuser()
 {
@@ -904,13 +2039,16 @@ bool AstroLink4Pi::AbortFocuser()
 		_abort = true;
 		_motionThread.join();
 	}
+	cfzPendingTarget = -1;
 	DEBUG(INDI::Logger::DBG_SESSION, "Focuser motion aborted.");
 	return true;
 }
 
 IPState AstroLink4Pi::MoveRelFocuser(FocusDirection dir, uint32_t ticks)
 {
-	uint32_t targetTicks = FocusAbsPosNP[0].getValue() + ((int32_t)ticks * (dir == FOCUS_INWARD ? -1 : 1));
+	// deferred sub-CFZ corrections are combined with the new one
+	double basePosition = (cfzPendingTarget >= 0) ? cfzPendingTarget : FocusAbsPosNP[0].getValue();
+	uint32_t targetTicks = basePosition + ((int32_t)ticks * (dir == FOCUS_INWARD ? -1 : 1));
 	return MoveAbsFocuser(targetTicks);
 }
 
@@ -922,12 +2060,45 @@ IPState AstroLink4Pi::MoveAbsFocuser(uint32_t targetTicks)
 		return IPS_ALERT;
 	}
 
+	double quantum = FocuserInfoN[FOC_STEPS_CFZ].value * CfzFractionN[0].value;
+	if (CfzPolicyS[CFZ_POLICY_ON].s == ISS_ON && quantum >= 1)
+	{
+		// moves smaller than the quantum make no optical difference, keep them pending
+		// returning IPS_OK would make the focuser interface store the target as the position
+		double displacement = (double)targetTicks - FocusAbsPosNP[0].getValue();
+		if (fabs(displacement) < quantum)
+		{
+			cfzPendingTarget = targetTicks;
+			cfzDeferred = true;
+			DEBUGF(INDI::Logger::DBG_SESSION, "Move by %0.0f steps is below %0.1f steps of CFZ quantum, deferred.", fabs(displacement), quantum);
+			return IPS_BUSY;
+		}
+
+		// the displacement is snapped, so the move is never shorter than one quantum
+		cfzPendingTarget = -1;
+		double snapped = FocusAbsPosNP[0].getValue() + round(displacement / quantum) * quantum;
+		targetTicks = std::min(std::max(snapped, FocusAbsPosNP[0].getMin()), FocusAbsPosNP[0].getMax());
+	}
+
+	return moveFocuser(targetTicks);
+}
+
+IPState AstroLink4Pi::moveFocuser(uint32_t targetTicks)
+{
 	if (targetTicks == FocusAbsPosNP[0].getValue())
 	{
 		DEBUG(INDI::Logger::DBG_SESSION, "Already at the requested position.");
 		return IPS_OK;
 	}
 
+	// a previous move must have handed the driver back before this one takes it
+	if (_motionThread.joinable())
+	{
+		_abort = true;
+		_motionThread.join();
+	}
+	_abort = false;
+
 	// set focuser busy
 	FocusAbsPosNP.setState(IPS_BUSY);
 	FocusAbsPosNP.apply();
@@ -964,67 +2135,199 @@ IPState AstroLink4Pi::MoveAbsFocuser(uint32_t targetTicks)
 
 	DEBUGF(INDI::Logger::DBG_SESSION, "Focuser is moving %s to position %d.", direction, targetTicks);
 
-	if (_motionThread.joinable())
-	{
-		_abort = true;
-		_motionThread.join();
-	}
-
-	_abort = false;
-	_motionThread = getMotorThread(targetTicks, lastDirection, pigpioHandle, backlashTicksRemaining);
+	_motionThread = getMotorThread(targetTicks, lastDirection, backlashTicksRemaining);
 	return IPS_BUSY;
 }
 
-std::thread AstroLink4Pi::getMotorThread(uint32_t targetTicks, int lastDirection, int pigpioHandle, int backlashTicksRemaining)
+std::thread AstroLink4Pi::getMotorThread(uint32_t targetTicks, int lastDirection, int backlashTicksRemaining)
 {
-	return std::thread([this](uint32_t targetPos, int direction, int pigpioHandle, int backlashTicksRemaining)
+	return std::thread([this](uint32_t targetPos, int direction, int backlashTicksRemaining)
 					   {
-		int motorDirection = direction;
+		MotionProfile profile;
+		profile.stepDelay = FocusStepDelayN[0].value;
+		profile.rampSteps = CurrentProfileN[PROFILE_RAMP].value;
+		profile.reverse = (FocusReverseSP[INDI_ENABLED].getState() == ISS_ON);
 
-		uint32_t currentPos = FocusAbsPosNP[0].getValue();
-		while (currentPos != targetPos && !_abort)
-		{
-			if (currentPos % 100 == 0)
+		uint32_t currentPos = motion.run(FocusAbsPosNP[0].getValue(), targetPos, direction, backlashTicksRemaining, profile, _abort,
+			[this](uint32_t position)
 			{
-				FocusAbsPosNP[0].setValue(currentPos);
+				FocusAbsPosNP[0].setValue(position);
 				FocusAbsPosNP.setState(IPS_BUSY);
 				FocusAbsPosNP.apply();
-			}
-			if (FocusReverseSP[INDI_ENABLED].getState() == ISS_ON)
+			},
+			[this](bool boost)
 			{
-				lgGpioWrite(pigpioHandle, DIR_PIN, (motorDirection < 0) ? 1 : 0);
-			}
-			else
+				// boost current while accelerating or decelerating, reduced current while cruising
+				applyMotorCurrent(StepperCurrentN[0].value * CurrentProfileN[boost ? PROFILE_BOOST : PROFILE_CRUISE].value / 100);
+			});
+		stopStepping();
+
+		// update abspos value and status, a move stopped by a brownout ends in alert
+		bool stopped = (currentPos != targetPos && motorHoldShed);
+		if (stopped)
+		{
+			DEBUGF(INDI::Logger::DBG_WARNING, "Focuser move stopped at position %i, motor power is shed.", (int)currentPos);
+		}
+		else
+		{
+			DEBUGF(INDI::Logger::DBG_SESSION, "Focuser moved to position %i", (int)currentPos);
+		}
+		FocusAbsPosNP[0].setValue(currentPos);
+		FocusAbsPosNP.setState(stopped ? IPS_ALERT : IPS_OK);
+		FocusAbsPosNP.apply();
+		FocusRelPosNP.setState(stopped ? IPS_ALERT : IPS_OK);
+		FocusRelPosNP.apply();
+
+		savePosition((int)FocusAbsPosNP[0].getValue() * MAX_RESOLUTION / resolution); // always save at MAX_RESOLUTION
+		lastTemperature = FocusTemperatureN[0].value;							// register last temperature
+
+		// let the rotor settle at cruise current before dropping to hold power
+		applyMotorCurrent(StepperCurrentN[0].value * CurrentProfileN[PROFILE_CRUISE].value / 100);
+		usleep(MOTOR_SETTLE_TIME * 1000);
+		finishMove(); },
+					   targetTicks, lastDirection, backlashTicksRemaining);
+}
+
+std::thread AstroLink4Pi::getHomingThread()
+{
+	return std::thread([this]()
+					   {
+		int backoff = HomeSwitchN[HOME_BACKOFF].value;
+		int fastDelay = HomeSwitchN[HOME_FAST_DELAY].value;
+		int slowDelay = HomeSwitchN[HOME_SLOW_DELAY].value;
+		long maxSteps = FocusMaxPosNP[0].getValue() * 1.1 + backoff;
+		bool homed = false;
+
+		// leave the switch first if the focuser already sits on it
+		for (long i = 0; i < maxSteps && lgGpioRead(pigpioHandle, homeGpio) == 0 && !_abort; i++)
+		{
+			stepPulse(1);
+			usleep(slowDelay);
+		}
+
+		// fast seek, back off the switch, then approach again slowly to latch the edge
+		if (!_abort && homeSeek(-1, fastDelay, maxSteps))
+		{
+			long backedOff = 0;
+			while ((backedOff < backoff || lgGpioRead(pigpioHandle, homeGpio) == 0) && backedOff < maxSteps && !_abort)
 			{
-				lgGpioWrite(pigpioHandle, DIR_PIN, (motorDirection < 0) ? 0 : 1);
+				stepPulse(1);
+				usleep(fastDelay);
+				backedOff++;
 			}
-			lgGpioWrite(pigpioHandle, STP_PIN, 1);
-			usleep(10);
-			lgGpioWrite(pigpioHandle, STP_PIN, 0);
 
-			if (backlashTicksRemaining <= 0)
-			{ // Only Count the position change if it is not due to backlash
-				currentPos += motorDirection;
-			}
-			else
-			{ // Don't count the backlash position change, just decrement the counter
-				backlashTicksRemaining -= 1;
+			if (!_abort && homeSeek(-1, slowDelay, backedOff + backoff))
+			{
+				// return the steps made after the edge so the motor rests exactly at the switch point
+				long overshoot = motion.stepCount - homeLatch;
+				for (long i = 0; i < overshoot && !_abort; i++)
+				{
+					stepPulse(1);
+					usleep(slowDelay);
+				}
+				homed = !_abort;
 			}
-			usleep(FocusStepDelayN[0].value);
 		}
+		stopStepping();
 
-		// update abspos value and status
-		DEBUGF(INDI::Logger::DBG_SESSION, "Focuser moved to position %i", (int)currentPos);
-		FocusAbsPosNP[0].setValue(currentPos);
-		FocusAbsPosNP.setState(IPS_OK);
+		if (homed)
+		{
+			FocusAbsPosNP[0].setValue(HomeSwitchN[HOME_POSITION].value);
+			FocusAbsPosNP.setState(IPS_OK);
+			savePosition((int)FocusAbsPosNP[0].getValue() * MAX_RESOLUTION / resolution); // always save at MAX_RESOLUTION
+			lastDirection = 1;
+			cfzPendingTarget = -1;
+			FocusHomeSP.s = IPS_OK;
+			DEBUGF(INDI::Logger::DBG_SESSION, "Focuser homed, position synced to %0.0f.", FocusAbsPosNP[0].getValue());
+		}
+		else
+		{
+			FocusAbsPosNP.setState(IPS_ALERT);
+			FocusHomeSP.s = IPS_ALERT;
+			DEBUG(INDI::Logger::DBG_WARNING, _abort ? "Focuser homing aborted." : "Home switch not found, focuser position is not synced.");
+		}
 		FocusAbsPosNP.apply();
-		FocusRelPosNP.setState(IPS_OK);
-		FocusRelPosNP.apply();
+		FocusHomeS[0].s = ISS_OFF;
+		IDSetSwitch(&FocusHomeSP, nullptr);
 
-		savePosition((int)FocusAbsPosNP[0].getValue() * MAX_RESOLUTION / resolution); // always save at MAX_RESOLUTION
-		lastTemperature = FocusTemperatureN[0].value;							// register last temperature
-		setCurrent(true); },
-					   targetTicks, lastDirection, pigpioHandle, backlashTicksRemaining);
+		lastTemperature = FocusTemperatureN[0].value;
+		finishMove(); });
+}
+
+bool AstroLink4Pi::homeSeek(int direction, int stepDelay, long maxSteps)
+{
+	homeTriggered = false;
+	homeArmed = true;
+	for (long i = 0; i < maxSteps && !homeTriggered && !_abort; i++)
+	{
+		stepPulse(direction);
+		usleep(stepDelay);
+	}
+	homeArmed = false;
+	return homeTriggered;
+}
+
+void AstroLink4Pi::stepPulse(int direction)
+{
+	motion.pulse(direction, FocusReverseSP[INDI_ENABLED].getState() == ISS_ON);
+}
+
+bool AstroLink4Pi::claimHomeSwitch(int gpio)
+{
+	releaseHomeSwitch();
+	if (gpio <= 0)
+		return true;
+
+	const int usedPins[] = {DECAY_PIN, EN_PIN, M0_PIN, M1_PIN, M2_PIN, RST_PIN, STP_PIN, DIR_PIN, OUT1_PIN, OUT2_PIN,
+							PWM1_PIN, PWM2_PIN, MOTOR_PWM, CHK_IN_PIN, FAN_PIN, I2C_SDA_PIN, I2C_SCL_PIN};
+	for (int pin : usedPins)
+	{
+		if (pin == gpio)
+		{
+			DEBUGF(INDI::Logger::DBG_ERROR, "GPIO %d is used by AstroLink 4 Pi and cannot be used for the home switch.", gpio);
+			return false;
+		}
+	}
+
+	// switch closes to ground, so the line is active low with the internal pull-up enabled
+	int rv = lgGpioClaimAlert(pigpioHandle, LG_SET_PULL_UP, LG_BOTH_EDGES, gpio, -1);
+	if (rv == LG_OKAY)
+		rv = lgGpioSetAlertsFunc(pigpioHandle, gpio, homeAlert, this);
+	if (rv != LG_OKAY)
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Cannot claim GPIO %d for the home switch. Error code %d", gpio, rv);
+		lgGpioFree(pigpioHandle, gpio);
+		return false;
+	}
+
+	homeGpio = gpio;
+	DEBUGF(INDI::Logger::DBG_SESSION, "Home switch enabled on GPIO %d.", gpio);
+	return true;
+}
+
+void AstroLink4Pi::releaseHomeSwitch()
+{
+	if (homeGpio <= 0)
+		return;
+
+	lgGpioSetAlertsFunc(pigpioHandle, homeGpio, nullptr, nullptr);
+	lgGpioFree(pigpioHandle, homeGpio);
+	homeGpio = 0;
+}
+
+void AstroLink4Pi::homeAlert(int num_alerts, lgGpioAlert_p alerts, void *userdata)
+{
+	AstroLink4Pi *device = static_cast<AstroLink4Pi *>(userdata);
+	for (int i = 0; i < num_alerts; i++)
+	{
+		// latch the step that caused the first active edge while a seek is armed. Alerts arrive
+		// late, so the edge is matched by its timestamp, taken on the clock of lguTimestamp()
+		if (alerts[i].report.gpio == device->homeGpio && alerts[i].report.level == 0 && device->homeArmed.exchange(false))
+		{
+			device->homeLatch = device->motion.stepAt(alerts[i].report.timestamp);
+			device->homeTriggered = true;
+		}
+	}
 }
 
 void AstroLink4Pi::SetResolution(int res)
@@ -1145,8 +2448,104 @@ int AstroLink4Pi::savePosition(int pos)
 	return pos;
 }
 
+void AstroLink4Pi::configureBrownout()
+{
+	brownoutVinMin = BrownoutSettingsN[0].value;
+	brownoutItotMax = BrownoutSettingsN[1].value;
+	brownoutHysteresis = BrownoutSettingsN[2].value;
+	brownoutRestoreDelay = BrownoutSettingsN[3].value;
+	for (int load = 0; load < LOAD_COUNT; load++)
+		shedPriority[load] = (int)ShedOrderN[load].value;
+	brownoutEnabled = (BrownoutS[0].s == ISS_ON);
+}
+
+void AstroLink4Pi::configureBattery()
+{
+	int chemistry = IUFindOnSwitchIndex(&BatteryTypeSP);
+	battery.configure(chemistry, BatterySettingsN[0].value, BatterySettingsN[1].value, BatterySettingsN[2].value * 60);
+	if (chemistry == BATTERY_NONE)
+	{
+		BatteryStatusNP.s = IPS_IDLE;
+		IDSetNumber(&BatteryStatusNP, nullptr);
+	}
+}
+
+void AstroLink4Pi::energyFileName(char *fileName)
+{
+	if (getenv("INDICONFIG"))
+	{
+		snprintf(fileName, MAXRBUF, "%s.energy", getenv("INDICONFIG"));
+	}
+	else
+	{
+		snprintf(fileName, MAXRBUF, "%s/.indi/%s.energy", getenv("HOME"), getDeviceName());
+	}
+}
+
+bool AstroLink4Pi::loadEnergy()
+{
+	char fileName[MAXRBUF];
+	energyFileName(fileName);
+
+	double charge = 0, energy = 0;
+	FILE *pFile = fopen(fileName, "r");
+	if (pFile == NULL)
+	{
+		DEBUGF(INDI::Logger::DBG_DEBUG, "No energy counters in %s, starting from zero.", fileName);
+		lifetimeAs = lifetimeWs = 0;
+		return false;
+	}
+	int read = fscanf(pFile, "%lf %lf", &charge, &energy);
+	fclose(pFile);
+	if (read != 2)
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Failed to read file %s.", fileName);
+		return false;
+	}
+	lifetimeAs = charge;
+	lifetimeWs = energy;
+	lastEnergySaved = charge;
+	DEBUGF(INDI::Logger::DBG_DEBUG, "Lifetime energy %0.2f Ah, %0.2f Wh restored from %s.", charge / 3600, energy / 3600, fileName);
+	return true;
+}
+
+bool AstroLink4Pi::saveEnergy()
+{
+	// skip the write when nothing was consumed since the last checkpoint
+	double charge = lifetimeAs;
+	double energy = lifetimeWs;
+	if (charge == lastEnergySaved)
+		return true;
+
+	char fileName[MAXRBUF];
+	char tempFileName[MAXRBUF];
+	energyFileName(fileName);
+
+	// write aside, sync and rename, so a power cut leaves either the old or the new counters
+	snprintf(tempFileName, MAXRBUF, "%s.tmp", fileName);
+	FILE *pFile = fopen(tempFileName, "w");
+	if (pFile == NULL)
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Failed to open file %s.", tempFileName);
+		return false;
+	}
+	bool written = fprintf(pFile, "%0.3f %0.3f\n", charge, energy) > 0;
+	written &= (fflush(pFile) == 0);
+	written &= (fsync(fileno(pFile)) == 0);
+	written &= (fclose(pFile) == 0);
+	if (!written || rename(tempFileName, fileName) != 0)
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Failed to write file %s.", fileName);
+		unlink(tempFileName);
+		return false;
+	}
+	lastEnergySaved = charge;
+	return true;
+}
+
 bool AstroLink4Pi::SyncFocuser(uint32_t ticks)
 {
+	cfzPendingTarget = -1;
 	FocusAbsPosNP[0].setValue(ticks);
 	FocusAbsPosNP.apply();
 	savePosition(ticks);
@@ -1181,8 +2580,13 @@ void AstroLink4Pi::temperatureCompensation()
 		// Move focuser once the compensation is larger than 1/2 CFZ
 		if (abs(deltaPos) > (FocuserInfoN[2].value / 2))
 		{
-			int thermalAdjustment = round(deltaPos);				   // adjust focuser by half number of steps to keep it in the center of cfz
-			MoveAbsFocuser(FocusAbsPosNP[0].getValue() + thermalAdjustment); // adjust focuser position
+			int thermalAdjustment = round(deltaPos); // adjust focuser by half number of steps to keep it in the center of cfz
+
+			// the compensation bypasses the CFZ quantum so no drift is lost, a deferred correction moves along with it
+			double basePosition = (cfzPendingTarget >= 0) ? cfzPendingTarget : FocusAbsPosNP[0].getValue();
+			double target = std::min(std::max(basePosition + thermalAdjustment, FocusAbsPosNP[0].getMin()), FocusAbsPosNP[0].getMax());
+			cfzPendingTarget = -1;
+			moveFocuser(target);						   // adjust focuser position
 			lastTemperature = FocusTemperatureN[0].value;			   // register last temperature
 			DEBUGF(INDI::Logger::DBG_SESSION, "Focuser adjusted by %d steps due to temperature change by %0.2fÂ°C", thermalAdjustment, deltaTemperature);
 		}
@@ -1209,22 +2613,24 @@ void AstroLink4Pi::setCurrent(bool standby)
 	if (!isConnected())
 		return;
 
+	// hold current a move returns to, its decay starts over
+	motorHoldCurrent = std::min(getHoldPower() * StepperCurrentN[0].value / 5, StepperCurrentN[0].max);
+	holdStartTime = millis();
+
 	if (standby)
 	{
-		lgGpioWrite(pigpioHandle, EN_PIN, (getHoldPower() > 0) ? 0 : 1);
-		lgGpioWrite(pigpioHandle, DECAY_PIN, 0);
-
-		if (revision < 4)
 		{
-			// for 0.1 ohm resistor Vref = iref / 2
-			setDac(0, 255 * (getHoldPower() * StepperCurrentN[0].value / 5) / 4096);
+			// a running move applies the new hold when it ends
+			std::lock_guard<std::mutex> lock(motorMutex);
+			if (!motorActive)
+				driveHold();
 		}
-		if (revision >= 4)
+
+		if (motorHoldShed)
 		{
-			lgTxPwm(pigpioHandle, MOTOR_PWM, 5000, getMotorPWM(getHoldPower() * StepperCurrentN[0].value / 5), 0, 0);
+			DEBUG(INDI::Logger::DBG_SESSION, "Stepper motor hold is shed until the supply recovers.");
 		}
-
-		if (getHoldPower() > 0)
+		else if (getHoldPower() > 0)
 		{
 			DEBUGF(INDI::Logger::DBG_SESSION, "Stepper motor enabled %d %%.", getHoldPower() * 20);
 		}
@@ -1235,478 +2641,1858 @@ void AstroLink4Pi::setCurrent(bool standby)
 	}
 	else
 	{
-		lgGpioWrite(pigpioHandle, EN_PIN, 0);
-		lgGpioWrite(pigpioHandle, DECAY_PIN, 1);
 		if (revision < 4)
 		{
 			DEBUGF(INDI::Logger::DBG_SESSION, "Stepper current %0.2f", StepperCurrentN[0].value);
-			// for 0.1 ohm resistor Vref = iref / 2
-			setDac(0, 255 * StepperCurrentN[0].value / 4096);
-		}
-		if (revision >= 4)
-		{
-			lgTxPwm(pigpioHandle, MOTOR_PWM, 5000, getMotorPWM(StepperCurrentN[0].value), 0, 0);
 		}
+		std::lock_guard<std::mutex> lock(motorMutex);
+		motorActive = true;
+		motorStepping = true;
+		lgGpioWrite(pigpioHandle, EN_PIN, 0);
+		lgGpioWrite(pigpioHandle, DECAY_PIN, 1);
+		driveMotor(std::min(StepperCurrentN[0].value, StepperCurrentN[0].max));
 	}
 }
 
-void AstroLink4Pi::systemUpdate()
+void AstroLink4Pi::driveHold()
 {
-	// update time
-	struct tm *local_timeinfo;
-	static char ts[32];
-	time_t rawtime;
-	time(&rawtime);
-	local_timeinfo = localtime(&rawtime);
-	strftime(ts, 20, "%Y-%m-%dT%H:%M:%S", local_timeinfo);
-	IUSaveText(&SysTimeT[SYST_TIME], ts);
-	snprintf(ts, sizeof(ts), "%4.2f", (local_timeinfo->tm_gmtoff / 3600.0));
-	IUSaveText(&SysTimeT[SYST_OFFSET], ts);
-	SysTimeTP.s = IPS_OK;
-	IDSetText(&SysTimeTP, NULL);
-
-	SysInfoTP.s = IPS_BUSY;
-	IDSetText(&SysInfoTP, NULL);
-
-	FILE *pipe;
-	char buffer[128];
+	// caller holds motorMutex, a shed hold keeps the driver off until the load is restored
+	double current = motorHoldShed ? 0 : motorHoldCurrent.load();
+	lgGpioWrite(pigpioHandle, EN_PIN, (current > 0) ? 0 : 1);
+	lgGpioWrite(pigpioHandle, DECAY_PIN, 0);
+	driveMotor(current);
+}
 
-	// update CPU temp
-	pipe = popen("echo $(($(cat /sys/class/thermal/thermal_zone0/temp)/1000))", "r");
-	if (fgets(buffer, 128, pipe) != NULL)
-		IUSaveText(&SysInfoT[SYSI_CPUTEMP], buffer);
-	pclose(pipe);
+void AstroLink4Pi::stopStepping()
+{
+	std::lock_guard<std::mutex> lock(motorMutex);
+	motorStepping = false;
+	if (!motorHoldShed)
+		return;
 
-	// update uptime
-	pipe = popen("uptime|awk -F, '{print $1}'|awk -Fup '{print $2}'|xargs", "r");
-	if (fgets(buffer, 128, pipe) != NULL)
-		IUSaveText(&SysInfoT[SYSI_UPTIME], buffer);
-	pclose(pipe);
+	// the hold was shed while stepping, the driver is dropped as soon as the steps end
+	lgGpioWrite(pigpioHandle, EN_PIN, 1);
+	driveMotor(0);
+	if (motorShedPending)
+	{
+		motorShedPending = false;
+		queueShedEvent(motorShedEvent, monotonicNs());
+	}
+}
 
-	// update load
-	pipe = popen("uptime|awk -F, '{print $3\" /\"$4\" /\"$5}'|awk -F: '{print $2}'|xargs", "r");
-	if (fgets(buffer, 128, pipe) != NULL)
-		IUSaveText(&SysInfoT[SYSI_LOAD], buffer);
-	pclose(pipe);
+void AstroLink4Pi::finishMove()
+{
+	// hand the driver back at hold current, or off while the hold is shed
+	holdStartTime = millis();
+	std::lock_guard<std::mutex> lock(motorMutex);
+	driveHold();
+	motorActive = false;
+}
 
-	SysInfoTP.s = IPS_OK;
-	IDSetText(&SysInfoTP, NULL);
+int AstroLink4Pi::setPwmOutput(int output, double duty)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+	pwmState[output] = duty;
+	return applyOutput(LOAD_PWM1 + output);
 }
 
-void AstroLink4Pi::getFocuserInfo()
+int AstroLink4Pi::setRelayOutput(int output, int state)
 {
-	// https://www.innovationsforesight.com/education/how-much-focus-error-is-too-much/
-	float travel_mm = (float)FocuserTravelN[0].value;
-	float aperture = (float)ScopeParametersN[SCOPE_DIAM].value;
-	float focal = (float)ScopeParametersN[SCOPE_FL].value;
-	float f_ratio;
+	std::lock_guard<std::mutex> lock(outputMutex);
+	relayState[output] = state;
+	return applyOutput(LOAD_OUT1 + output);
+}
 
-	// handle no snooping data from telescope
-	if (aperture * focal != 0)
+int AstroLink4Pi::applyOutput(int load)
+{
+	// requested state unless the load is shed or held by the startup profile, caller holds outputMutex
+	bool shed = (shedMask | profileHold) & (1 << load);
+	int rv = 0;
+	switch (load)
 	{
-		f_ratio = focal / aperture;
-	}
-	else
+	case LOAD_PWM1:
+	case LOAD_PWM2:
 	{
-		f_ratio = 0;
-		DEBUG(INDI::Logger::DBG_DEBUG, "No telescope focal length and/or aperture info available.");
+		// a new target merges into a ramp in progress, a shed heater ramps up again from zero
+		int output = load - LOAD_PWM1;
+		if (shed)
+			pwmRamped[output] = 0;
+		else if (pwmRampRate[output] <= 0 || !rampActive)
+			pwmRamped[output] = pwmState[output];
+		else
+			rampCv.notify_one();
+		rv = applyPwmOutputs();
+		loadLevelChanged(load, pwmDuty(output) / 100);
+		break;
+	}
+	case LOAD_OUT1:
+		rv = lgGpioWrite(pigpioHandle, OUT1_PIN, shed ? 0 : relayState[0]);
+		loadLevelChanged(load, shed ? 0 : relayState[0]);
+		break;
+	case LOAD_OUT2:
+		rv = lgGpioWrite(pigpioHandle, OUT2_PIN, shed ? 0 : relayState[1]);
+		loadLevelChanged(load, shed ? 0 : relayState[1]);
+		break;
 	}
+	return rv;
+}
 
-	float cfz = 4.88 * 0.520 * pow(f_ratio, 2); // CFZ = 4.88 Â· Î» Â· f^2
-	float step_size = 1000.0 * travel_mm / FocusMaxPosNP[0].getValue();
-	float steps_per_cfz = (int)cfz / step_size;
+int AstroLink4Pi::setFanOutput(double duty)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+	fanDuty = duty;
+	return applyPwmOutputs();
+}
 
-	if (steps_per_cfz >= 4)
+int AstroLink4Pi::applyPwmOutputs()
+{
+	// caller holds outputMutex
+	// duties are issued in whole percent, a request that changes nothing is not sent as it would cut the running cycle
+	double duty[3];
+	duty[0] = round(pwmDuty(0));
+	duty[1] = round(pwmDuty(1));
+	duty[2] = round(std::max(fanDuty, 0.0));
+	int count = (fanDuty >= 0) ? 3 : 2;
+
+	// the fan joins the interleave only when it already runs at the heater frequency, otherwise it
+	// keeps FAN_FREQUENCY and is not restarted for heater changes
+	int interleaved = 0;
+	if (pwmInterleaved)
+		interleaved = (count == 3 && pwmFrequency == FAN_FREQUENCY) ? 3 : 2;
+	int offset[3] = {0, 0, 0};
+	if (interleaved > 0)
+		pwmInterleave(duty, interleaved, pwmFrequency, offset);
+	double frequency[3] = {pwmFrequency, pwmFrequency, FAN_FREQUENCY};
+
+	bool changed[3] = {false, false, false};
+	bool anyChanged = false;
+	bool interleaveChanged = false;
+	for (int output = 0; output < count; output++)
 	{
-		FocuserInfoNP.s = IPS_OK;
+		changed[output] = (duty[output] != pwmIssued[output].duty || offset[output] != pwmIssued[output].offset || frequency[output] != pwmIssued[output].frequency);
+		anyChanged |= changed[output];
+		if (output < interleaved)
+			interleaveChanged |= changed[output];
 	}
-	else if (steps_per_cfz > 2 && steps_per_cfz < 4)
+	if (!anyChanged)
+		return 0;
+
+	// the peak current of a phase mode is attributed only while the heater settings stay unchanged
+	if (changed[0] || changed[1])
 	{
-		FocuserInfoNP.s = IPS_BUSY;
+		pwmOverlapFraction = pwmOverlap(duty, offset, 2, pwmFrequency);
+		pwmPhaseSince = millis();
 	}
-	else
+
+	int pins[3] = {PWM1_PIN, PWM2_PIN, FAN_PIN};
+	int rv = 0;
+	for (int output = 0; output < count; output++)
 	{
-		FocuserInfoNP.s = IPS_ALERT;
+		// lgpio times every PWM output in software and counts its offset from that output's own
+		// start, so interleaved outputs keep their phases only when restarted back to back
+		if (!changed[output] && !(output < interleaved && interleaveChanged))
+			continue;
+		if (lgTxPwm(pigpioHandle, pins[output], frequency[output], duty[output], offset[output], 0) != 0)
+		{
+			pwmIssued[output] = PwmIssue();
+			if (output < 2)
+				rv = -1;
+			continue;
+		}
+		pwmIssued[output] = {duty[output], offset[output], frequency[output]};
 	}
-
-	FocuserInfoN[FOC_STEP_SIZE].value = step_size;
-	FocuserInfoN[FOC_CFZ].value = cfz;
-	FocuserInfoN[FOC_STEPS_CFZ].value = steps_per_cfz;
-	IDSetNumber(&FocuserInfoNP, nullptr);
-
-	DEBUGF(INDI::Logger::DBG_DEBUG, "Focuser Info: %0.2f %0.2f %0.2f.", FocuserInfoN[0].value, FocuserInfoN[1].value, FocuserInfoN[2].value);
+	return rv;
 }
 
-long int AstroLink4Pi::millis()
+double AstroLink4Pi::pwmDuty(int output)
 {
-	static uint64_t nsec_zero = lguTimestamp();
-	int millis = (int)((lguTimestamp() - nsec_zero) / 1000000);
-	return millis;
+	// requested duty within the budget limit, nothing while shed, caller holds outputMutex
+	if ((shedMask | profileHold) & (1 << (LOAD_PWM1 + output)))
+		return 0;
+	return std::min(pwmRamped[output], pwmLimit[output]);
 }
 
-int AstroLink4Pi::getMotorPWM(int current)
+void AstroLink4Pi::configureBudget()
 {
-	// 100 = 1.03V = 2.06A, 1 = 20mA
-	return current / 20;
+	double itotMax = BudgetSettingsN[0].value;
+	double ptotMax = BudgetSettingsN[1].value;
+	if (BudgetS[0].s != ISS_ON)
+		itotMax = ptotMax = 0;
+	powerBudget.configure(itotMax, ptotMax, BudgetSettingsN[2].value, BudgetSettingsN[3].value);
 }
 
-int AstroLink4Pi::setDac(int chan, int value)
+void AstroLink4Pi::budgetUpdate(const SensorSnapshot &sample)
 {
-	char spiData[2];
-	uint8_t chanBits, dataBits;
+	if (!sample.powerValid)
+		return;
+
+	// single samples land anywhere in the heater PWM cycle, the budget works on the mean current
+	// over whole PWM periods, and only on samples taken after its last change
+	double window = std::max((double)BUDGET_AVERAGE_WINDOW, 2000.0 / pwmFrequency);
+	uint64_t now = monotonicNs();
+	uint64_t since = std::max(now - (uint64_t)(window * 1e6), budgetChanged);
+	double itot;
+	if (sampleMean(ADC_IREAL, since, itot) < window / 2)
+		return;
+	long int timeMillis = millis();
+	double dt = (lastBudgetUpdate > 0) ? (timeMillis - lastBudgetUpdate) / 1000.0 : 0;
+	lastBudgetUpdate = timeMillis;
+
+	double requested[BUDGET_OUTPUTS] = {PWM1N[0].value, PWM2N[0].value};
+	double model[BUDGET_OUTPUTS];
+	int priority[BUDGET_OUTPUTS] = {shedPriority[LOAD_PWM1], shedPriority[LOAD_PWM2]};
+	{
+		std::lock_guard<std::mutex> lock(loadMutex);
+		model[0] = loadModel.model(LOAD_PWM1);
+		model[1] = loadModel.model(LOAD_PWM2);
+	}
+
+	if (powerBudget.update(itot, sample.vin, requested, model, priority, dt))
+	{
+		budgetChanged = now;
+		std::lock_guard<std::mutex> lock(outputMutex);
+		for (int output = 0; output < BUDGET_OUTPUTS; output++)
+		{
+			double limit = round(powerBudget.limit(output));
+			if (limit == pwmLimit[output])
+				continue;
+			double before = pwmDuty(output);
+			pwmLimit[output] = limit;
+			applyOutput(LOAD_PWM1 + output);
+			if (limit < 100)
+			{
+				DEBUGF(INDI::Logger::DBG_SESSION, "Power budget: PWM %d limited to %0.0f %% (requested %0.0f %%, was %0.0f %%), Itot %0.2f A", output + 1, limit,
+					   requested[output], before, itot);
+			}
+			else
+			{
+				DEBUGF(INDI::Logger::DBG_SESSION, "Power budget: PWM %d released, Itot %0.2f A", output + 1, itot);
+			}
+		}
+	}
+
+	BudgetStatusN[0].value = pwmLimit[0];
+	BudgetStatusN[1].value = pwmLimit[1];
+	BudgetStatusN[2].value = powerBudget.headroom();
+	BudgetStatusNP.s = (pwmLimit[0] < 100 || pwmLimit[1] < 100) ? IPS_BUSY : IPS_OK;
+	IDSetNumber(&BudgetStatusNP, nullptr);
+}
+
+double AstroLink4Pi::sampleMean(int channel, uint64_t sinceNs, double &mean)
+{
+	// mean of the channel samples taken since sinceNs, returns the time they span in ms
+	PowerSample samples[ADC_RING_SIZE];
+	size_t count = adcRing[channel].copy(samples, ADC_RING_SIZE);
+	double sum = 0;
+	size_t used = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (samples[i].time < sinceNs)
+			continue;
+		sum += samples[i].value;
+		used++;
+	}
+	if (used == 0)
+		return 0;
+	mean = sum / used;
+	return (samples[count - 1].time - samples[count - used].time) / 1e6;
+}
+
+void AstroLink4Pi::rampLoop()
+{
+	std::unique_lock<std::mutex> lock(outputMutex);
+	auto last = std::chrono::steady_clock::now();
+	while (!_rampStop)
+	{
+		bool ramping = false;
+		for (int output = 0; output < 2; output++)
+			ramping |= (pwmRamped[output] != pwmState[output] && !((shedMask | profileHold) & (1 << (LOAD_PWM1 + output))));
+		if (!ramping)
+		{
+			rampCv.wait(lock);
+			last = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		// a new PWM request restarts the cycle, so the duty steps at most once per PWM period
+		rampCv.wait_for(lock, std::chrono::milliseconds((int)std::max((double)PWM_RAMP_PERIOD, ceil(1000 / pwmFrequency))));
+		auto now = std::chrono::steady_clock::now();
+		double dt = std::chrono::duration<double>(now - last).count();
+		last = now;
+
+		bool changed = false;
+		for (int output = 0; output < 2; output++)
+		{
+			if (((shedMask | profileHold) & (1 << (LOAD_PWM1 + output))) || pwmRamped[output] == pwmState[output])
+				continue;
+			double step = (pwmRampRate[output] > 0) ? pwmRampRate[output] * dt : 100;
+			double delta = pwmState[output] - pwmRamped[output];
+			pwmRamped[output] = (fabs(delta) <= step) ? pwmState[output] : pwmRamped[output] + copysign(step, delta);
+			changed = true;
+		}
+		if (changed)
+		{
+			applyPwmOutputs();
+			loadLevelChanged(LOAD_PWM1, pwmDuty(0) / 100);
+			loadLevelChanged(LOAD_PWM2, pwmDuty(1) / 100);
+		}
+	}
+}
+
+void AstroLink4Pi::stopRampThread()
+{
+	if (_rampThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(outputMutex);
+			_rampStop = true;
+			rampActive = false;
+		}
+		rampCv.notify_all();
+		_rampThread.join();
+	}
+}
+
+void AstroLink4Pi::loadLevelChanged(int load, double level)
+{
+	std::lock_guard<std::mutex> lock(loadMutex);
+	uint64_t timeNs = monotonicNs();
+	if (loadModel.setLevel(load, level, timeNs) && captureActive)
+		captureEvent = timeNs;
+}
+
+void AstroLink4Pi::configureDewHeater(int channel)
+{
+	DewHeaterSettings settings;
+	settings.margin = DewSettingsN[channel][DEW_MARGIN].value;
+	settings.gain = DewSettingsN[channel][DEW_GAIN].value;
+	settings.tau = DewSettingsN[channel][DEW_TAU].value;
+	settings.kp = DewSettingsN[channel][DEW_KP].value;
+	settings.ki = DewSettingsN[channel][DEW_KI].value;
+	settings.skyCoupling = DewSettingsN[channel][DEW_SKY_COUPLING].value;
+	dewControl[channel].configure(settings);
+}
+
+void AstroLink4Pi::dewUpdate(long int timeMillis)
+{
+	double dt = (lastDewUpdate > 0) ? (timeMillis - lastDewUpdate) / 1000.0 : 0;
+	lastDewUpdate = timeMillis;
+
+	INumberVectorProperty *pwmProperties[2] = {&PWM1NP, &PWM2NP};
+	bool controlled = false;
+	for (int channel = 0; channel < 2; channel++)
+	{
+		if (DewControlS[channel][DEW_AUTO].s != ISS_ON)
+			continue;
+		controlled = true;
+
+		// without humidity the last duty is kept
+		if (!lastSample.shtValid)
+		{
+			pwmProperties[channel]->s = IPS_ALERT;
+			IDSetNumber(pwmProperties[channel], nullptr);
+			continue;
+		}
+
+		double sky = lastSample.mlxValid ? lastSample.skyTemperature : NAN;
+		double applied;
+		{
+			std::lock_guard<std::mutex> lock(outputMutex);
+			applied = pwmDuty(channel);
+		}
+		double duty = dewControl[channel].update(lastSample.temperature, lastSample.dewPoint, sky, applied, dt);
+		INumber *pwm = pwmProperties[channel]->np;
+		pwmProperties[channel]->s = IPS_BUSY;
+		if (fabs(duty - pwm->value) >= 1)
+		{
+			pwm->value = round(duty);
+			setPwmOutput(channel, pwm->value);
+		}
+		IDSetNumber(pwmProperties[channel], nullptr);
+	}
+
+	// achieved duty, lower than requested while shed, budget limited or ramping
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		DewStatusN[0].value = pwmDuty(0);
+		DewStatusN[1].value = pwmDuty(1);
+	}
+	DewStatusN[2].value = dewControl[0].opticTemperature();
+	DewStatusN[3].value = dewControl[1].opticTemperature();
+	{
+		std::lock_guard<std::mutex> lock(loadMutex);
+		DewStatusN[4].value = loadModel.energyWs(LOAD_PWM1) / 3600;
+		DewStatusN[5].value = loadModel.energyWs(LOAD_PWM2) / 3600;
+	}
+	DewStatusNP.s = controlled ? IPS_BUSY : IPS_IDLE;
+	IDSetNumber(&DewStatusNP, nullptr);
+}
+
+void AstroLink4Pi::loadEnergyUpdate()
+{
+	std::lock_guard<std::mutex> lock(loadMutex);
+	for (int load = 0; load < LOAD_COUNT; load++)
+	{
+		LoadModelsN[load].value = loadModel.model(load);
+		LoadEnergyN[load].value = loadModel.energyWs(load) / 3600;
+	}
+	LoadEnergyN[LOAD_COUNT].value = loadModel.otherEnergyWs() / 3600;
+	LoadModelsNP.s = IPS_OK;
+	LoadEnergyNP.s = IPS_OK;
+	IDSetNumber(&LoadModelsNP, nullptr);
+	IDSetNumber(&LoadEnergyNP, nullptr);
+}
+
+void AstroLink4Pi::applyMotorCurrent(double current)
+{
+	// driver reference is limited to the highest current the board supports
+	current = std::min(current, StepperCurrentN[0].max);
+
+	// a shed hold stays off, only the steps of a move drive the motor meanwhile
+	std::lock_guard<std::mutex> lock(motorMutex);
+	if (motorHoldShed && !motorStepping)
+		return;
+	driveMotor(current);
+}
+
+void AstroLink4Pi::driveMotor(double current)
+{
+	// caller holds motorMutex
+	if (revision < 4)
+	{
+		// for 0.1 ohm resistor Vref = iref / 2
+		setDac(0, 255 * current / 4096);
+	}
+	if (revision >= 4)
+	{
+		lgTxPwm(pigpioHandle, MOTOR_PWM, 5000, getMotorPWM(current), 0, 0);
+		loadLevelChanged(LOAD_MOTOR, current / 1000);
+	}
+	motorCurrent = current;
+}
+
+void AstroLink4Pi::holdUpdate(long int timeMillis)
+{
+	double dt = (timeMillis - lastHoldUpdate) / 1000.0;
+	lastHoldUpdate = timeMillis;
+
+	// first order thermal model of the motor: P = I^2 * R heats it towards P * Rth with time constant tau
+	double current = motorCurrent;
+	double amps = current / 1000.0;
+	double steadyRise = amps * amps * MotorThermalN[THERMAL_R_COIL].value * MotorThermalN[THERMAL_R_TH].value;
+	motorTempRise += (steadyRise - motorTempRise) * (1 - exp(-dt / MotorThermalN[THERMAL_TAU].value));
+
+	double maxRise = MotorThermalN[THERMAL_MAX_RISE].value;
+	MotorTemperatureN[MOTOR_CURRENT].value = current;
+	MotorTemperatureN[MOTOR_TEMP_RISE].value = motorTempRise;
+	MotorTemperatureNP.s = (motorTempRise < maxRise) ? IPS_OK : IPS_BUSY;
+	IDSetNumber(&MotorTemperatureNP, nullptr);
+
+	// hold policy applies only while the hold is not shed and no move owns the driver, which
+	// includes the settle after the last step until the motion thread has applied the hold
+	if (motorHoldShed || motorActive)
+		return;
+	double holdCurrent = getHoldPower() * StepperCurrentN[0].value / 5;
+	if (holdCurrent <= 0)
+		return;
+
+	double targetCurrent = holdCurrent;
+	if (HoldDecayN[HOLD_DECAY_TIME].value > 0 && timeMillis - holdStartTime > HoldDecayN[HOLD_DECAY_TIME].value * 1000)
+	{
+		targetCurrent = std::min(targetCurrent, StepperCurrentN[0].value * HoldDecayN[HOLD_DECAY_LEVEL].value / 100);
+	}
+	if (motorTempRise >= maxRise)
+		holdCapped = true;
+	else if (motorTempRise < maxRise - THERMAL_HYSTERESIS)
+		holdCapped = false;
+	if (holdCapped)
+	{
+		// current whose steady state rise equals the limit
+		double capCurrent = 1000 * sqrt(maxRise / (MotorThermalN[THERMAL_R_COIL].value * MotorThermalN[THERMAL_R_TH].value));
+		targetCurrent = std::min(targetCurrent, capCurrent);
+	}
+
+	if (fabs(targetCurrent - current) >= 1)
+	{
+		motorHoldCurrent = targetCurrent;
+		{
+			std::lock_guard<std::mutex> lock(motorMutex);
+			driveHold();
+		}
+		DEBUGF(INDI::Logger::DBG_SESSION, "Stepper hold current set to %0.0f mA (idle %ld s, est. temperature rise %0.1f C).", targetCurrent, (timeMillis - holdStartTime) / 1000, motorTempRise);
+	}
+}
+
+void AstroLink4Pi::systemUpdate()
+{
+	// update time
+	struct tm *local_timeinfo;
+	static char ts[32];
+	time_t rawtime;
+	time(&rawtime);
+	local_timeinfo = localtime(&rawtime);
+	strftime(ts, 20, "%Y-%m-%dT%H:%M:%S", local_timeinfo);
+	IUSaveText(&SysTimeT[SYST_TIME], ts);
+	snprintf(ts, sizeof(ts), "%4.2f", (local_timeinfo->tm_gmtoff / 3600.0));
+	IUSaveText(&SysTimeT[SYST_OFFSET], ts);
+	SysTimeTP.s = IPS_OK;
+	IDSetText(&SysTimeTP, NULL);
+
+	SysInfoTP.s = IPS_BUSY;
+	IDSetText(&SysInfoTP, NULL);
+
+	char buffer[64];
+	double value;
+	double load[3];
+
+	// update CPU temp
+	if (systemMetrics.cpuTemperature(value))
+	{
+		SystemMetrics::formatTemperature(value, buffer, sizeof(buffer));
+		IUSaveText(&SysInfoT[SYSI_CPUTEMP], buffer);
+	}
+
+	// update uptime
+	if (systemMetrics.uptime(value))
+	{
+		SystemMetrics::formatUptime(value, buffer, sizeof(buffer));
+		IUSaveText(&SysInfoT[SYSI_UPTIME], buffer);
+	}
+
+	// update load
+	if (systemMetrics.loadAverage(load))
+	{
+		SystemMetrics::formatLoad(load, buffer, sizeof(buffer));
+		IUSaveText(&SysInfoT[SYSI_LOAD], buffer);
+	}
+
+	SysInfoTP.s = IPS_OK;
+	IDSetText(&SysInfoTP, NULL);
+}
+
+void AstroLink4Pi::getFocuserInfo()
+{
+	// https://www.innovationsforesight.com/education/how-much-focus-error-is-too-much/
+	float travel_mm = (float)FocuserTravelN[0].value;
+	float aperture = (float)ScopeParametersN[SCOPE_DIAM].value;
+	float focal = (float)ScopeParametersN[SCOPE_FL].value;
+	float f_ratio;
+
+	// handle no snooping data from telescope
+	if (aperture * focal != 0)
+	{
+		f_ratio = focal / aperture;
+	}
+	else
+	{
+		f_ratio = 0;
+		DEBUG(INDI::Logger::DBG_DEBUG, "No telescope focal length and/or aperture info available.");
+	}
+
+	float cfz = 4.88 * 0.520 * pow(f_ratio, 2); // CFZ = 4.88 Â· Î» Â· f^2
+	float step_size = 1000.0 * travel_mm / FocusMaxPosNP[0].getValue();
+	float steps_per_cfz = (int)cfz / step_size;
+
+	if (steps_per_cfz >= 4)
+	{
+		FocuserInfoNP.s = IPS_OK;
+	}
+	else if (steps_per_cfz > 2 && steps_per_cfz < 4)
+	{
+		FocuserInfoNP.s = IPS_BUSY;
+	}
+	else
+	{
+		FocuserInfoNP.s = IPS_ALERT;
+	}
+
+	FocuserInfoN[FOC_STEP_SIZE].value = step_size;
+	FocuserInfoN[FOC_CFZ].value = cfz;
+	FocuserInfoN[FOC_STEPS_CFZ].value = steps_per_cfz;
+	IDSetNumber(&FocuserInfoNP, nullptr);
+
+	DEBUGF(INDI::Logger::DBG_DEBUG, "Focuser Info: %0.2f %0.2f %0.2f.", FocuserInfoN[0].value, FocuserInfoN[1].value, FocuserInfoN[2].value);
+}
+
+long int AstroLink4Pi::millis()
+{
+	static uint64_t nsec_zero = lguTimestamp();
+	int millis = (int)((lguTimestamp() - nsec_zero) / 1000000);
+	return millis;
+}
+
+int AstroLink4Pi::getMotorPWM(int current)
+{
+	// 100 = 1.03V = 2.06A, 1 = 20mA
+	return current / 20;
+}
+
+int AstroLink4Pi::setDac(int chan, int value)
+{
+	char spiData[2];
+	uint8_t chanBits, dataBits;
+
+	if (chan == 0)
+		chanBits = 0x30;
+	else
+		chanBits = 0xB0;
+
+	chanBits |= ((value >> 4) & 0x0F);
+	dataBits = ((value << 4) & 0xF0);
+
+	spiData[0] = chanBits;
+	spiData[1] = dataBits;
+
+	int spiHandle = lgSpiOpen(pigpioHandle, 1, 100000, 0);
+	int written = lgSpiWrite(spiHandle, spiData, 2);
+	lgSpiClose(spiHandle);
+
+	return written;
+}
+
+void AstroLink4Pi::configureFan()
+{
+	FanSettings settings;
+	settings.target = FanSettingsN[FAN_TARGET].value;
+	settings.hysteresis = FanSettingsN[FAN_HYSTERESIS].value;
+	settings.minDuty = FanSettingsN[FAN_MIN_DUTY].value;
+	settings.kp = FanSettingsN[FAN_KP].value;
+	settings.ki = FanSettingsN[FAN_KI].value;
+	settings.kd = FanSettingsN[FAN_KD].value;
+	fanControl.configure(settings);
+}
+
+double AstroLink4Pi::readCpuTemperature()
+{
+	double celsius;
+	return systemMetrics.cpuTemperature(celsius) ? celsius : NAN;
+}
+
+void AstroLink4Pi::fanUpdate(long int timeMillis)
+{
+	double dt = (lastFanUpdate > 0) ? (timeMillis - lastFanUpdate) / 1000.0 : 0;
+	lastFanUpdate = timeMillis;
+
+	if (!fanAvailable)
+	{
+		if (FanPowerNP.s != IPS_ALERT)
+		{
+			FanPowerNP.s = IPS_ALERT;
+			IDSetNumber(&FanPowerNP, nullptr);
+		}
+		return;
+	}
+
+	// without a temperature the fan runs at full speed rather than letting the CPU throttle
+	double temperature = readCpuTemperature();
+	double duty = 100;
+	if (!isnan(temperature))
+	{
+		duty = round(fanControl.update(temperature, dt));
+		FanPowerN[1].value = fanControl.temperature();
+		FanPowerNP.s = fanControl.running() ? IPS_BUSY : IPS_OK;
+	}
+	else
+	{
+		fanControl.reset();
+		FanPowerNP.s = IPS_ALERT;
+	}
+
+	// restarting the PWM is only worth it for a noticeable change
+	if (fanDuty < 0 || fabs(duty - fanDuty) >= 1)
+		setFanOutput(duty);
+	FanPowerN[0].value = duty;
+	IDSetNumber(&FanPowerNP, nullptr);
+}
+
+void AstroLink4Pi::sensorLoop()
+{
+	SensorSnapshot sample;
+	long int period[SENSOR_COUNT] = {TEMPERATURE_UPDATE_TIMEOUT, TEMPERATURE_UPDATE_TIMEOUT, POLL_PERIOD, TEMPERATURE_UPDATE_TIMEOUT, POLL_PERIOD};
+	long int nextRead[SENSOR_COUNT] = {0};
+	shtRunningRate = -1;
+	shtFetchFailures = 0;
+
+	while (!_sensorStop)
+	{
+		long int timeMillis = millis();
+		bool updated = false;
+
+		// SHT results are fetched slightly slower than the sensor measures them so a fetch never finds no data
+		const long int shtPeriods[SHT_RATE_COUNT] = {2000, 1000, 500, 250, 200};
+		period[SENSOR_SHT] = shtPeriods[shtRate] * (100 + SHT_FETCH_SLACK) / 100;
+
+		for (int sensor = 0; sensor < SENSOR_COUNT; sensor++)
+		{
+			if (nextRead[sensor] > timeMillis)
+				continue;
+
+			nextRead[sensor] = timeMillis + period[sensor];
+			updated = true;
+			switch (sensor)
+			{
+			case SENSOR_SHT:
+				readSHT(sample);
+				break;
+			case SENSOR_MLX:
+				readMLX(sample);
+				break;
+			case SENSOR_TSL:
+				readTSL(sample);
+				nextRead[sensor] = timeMillis + tslPollPeriod();
+				break;
+			case SENSOR_OLDSQM:
+				// legacy SQM is only polled when there is no TSL2591 sensor
+				if (TSLmode == TSL_NOTAVAILABLE)
+					readOLD(sample);
+				break;
+			case SENSOR_POWER:
+				readPower(sample);
+				break;
+			}
+		}
+		if (updated)
+			sensorSnapshot.publish(sample);
+
+		// sleep until the next sensor is due, waking up regularly to notice disconnect
+		long int nextDue = *std::min_element(nextRead, nextRead + SENSOR_COUNT);
+		long int sleepTime = std::min(nextDue - millis(), (long int)SENSOR_IDLE_WAIT);
+		if (sleepTime > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(sleepTime));
+	}
+
+	stopSHT();
+}
+
+void AstroLink4Pi::stopSensorThread()
+{
+	if (_sensorThread.joinable())
+	{
+		_sensorStop = true;
+		_sensorThread.join();
+	}
+}
+
+void AstroLink4Pi::publishSensors(const SensorSnapshot &sample)
+{
+	if (sample.shtTime != lastSample.shtTime)
+	{
+		setParameterValue("WEATHER_TEMPERATURE", sample.shtValid ? sample.temperature : 0.0);
+		setParameterValue("WEATHER_HUMIDITY", sample.shtValid ? sample.humidity : 0.0);
+		setParameterValue("WEATHER_DEWPOINT", sample.shtValid ? sample.dewPoint : 0.0);
+	}
+
+	if (sample.mlxTime != lastSample.mlxTime)
+	{
+		setParameterValue("WEATHER_SKY_TEMP", sample.mlxValid ? sample.skyTemperature : 0.0);
+		setParameterValue("WEATHER_SKY_DIFF", sample.mlxValid ? sample.skyDifference : 0.0);
+	}
+
+	if (sample.sqmTime != lastSample.sqmTime && sample.sqmValid)
+	{
+		setParameterValue("SQM_READING", sample.sqm);
+		SqmStatsN[0].value = sample.sqmError;
+		SqmStatsN[1].value = sample.sqmSamples;
+		SqmStatsNP.s = IPS_OK;
+		IDSetNumber(&SqmStatsNP, nullptr);
+	}
+
+	if (sample.powerTime != lastSample.powerTime)
+	{
+		PowerReadingsN[POW_VIN].value = sample.vin;
+		PowerReadingsN[POW_VREG].value = sample.vreg;
+		PowerReadingsN[POW_ITOT].value = sample.itot;
+		PowerReadingsN[POW_PTOT].value = sample.vin * sample.itot;
+		PowerReadingsN[POW_AH].value = sample.energyAs / 3600;
+		PowerReadingsN[POW_WH].value = sample.energyWs / 3600;
+		PowerReadingsNP.s = sample.powerValid ? IPS_OK : IPS_ALERT;
+		IDSetNumber(&PowerReadingsNP, nullptr);
+
+		EnergyCountersN[0].value = sample.lifetimeAs / 3600;
+		EnergyCountersN[1].value = sample.lifetimeWs / 3600;
+		EnergyCountersNP.s = sample.powerValid ? IPS_OK : IPS_IDLE;
+		IDSetNumber(&EnergyCountersNP, nullptr);
+
+		if (sample.powerValid)
+			battery.update(sample.vin, sample.itot, sample.chargeAs, sample.powerTime);
+		if (battery.valid())
+		{
+			BatteryStatusN[0].value = battery.soc();
+			BatteryStatusN[1].value = battery.remainingAh();
+			BatteryStatusN[2].value = battery.runtime(sample.itot);
+			BatteryStatusN[3].value = battery.runtime(battery.averageCurrent());
+			BatteryStatusN[4].value = battery.averageCurrent();
+			BatteryStatusNP.s = (battery.soc() < BATTERY_LOW_SOC) ? IPS_ALERT : IPS_OK;
+			IDSetNumber(&BatteryStatusNP, nullptr);
+		}
+
+		for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+			AdcChannelsN[channel].value = sample.adcChannel[channel];
+		AdcChannelsN[ADC_CHANNEL_COUNT].value = sample.adcRate;
+		AdcChannelsNP.s = sample.powerValid ? IPS_OK : IPS_ALERT;
+		IDSetNumber(&AdcChannelsNP, nullptr);
+	}
+
+	lastSample = sample;
+}
+
+bool AstroLink4Pi::readTSL(SensorSnapshot &sample)
+{
+	bool available = false;
+	int i2cHandle = getI2cHandle(I2C_TSL);
+	
+	if(i2cHandle < 0)
+	{
+		TSLmode = TSL_NOTAVAILABLE;
+		return false;
+	}
+	
+	if(TSLmode == TSL_NOTAVAILABLE) 
+	{
+		int write = i2cResult(I2C_TSL, lgI2cWriteByte(i2cHandle, 0x80 | 0x20 | 0x12));
+		if(write == 0) {
+			TSLmode = TSL_AVAILABLE;
+			available = true;
+		}
+	}
+	else if(TSLmode == TSL_AVAILABLE)
+	{
+		// Enable device - power down mode on boot
+		int write = i2cResult(I2C_TSL, lgI2cWriteByteData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE, TSL2591_ENABLE_POWEROFF));
+		tslRange.reset();
+		sqmEstimator.reset();
+		adcStartTime = 0;
+
+		TSLmode = (write == 0) ? TSL_INITIALIZED : TSL_NOTAVAILABLE;
+		available = (write == 0);
+	}
+	else if(TSLmode == TSL_INITIALIZED)
+	{
+		int write = 0;
+		if(adcStartTime != 0)
+		{
+			if(millis() < adcStartTime + tslRange.integrationMs() + TSL2591_ADC_MARGIN)
+				return true;
+
+			int ir = i2cResult(I2C_TSL, lgI2cReadWordData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CHAN1_LOW));
+			int full = i2cResult(I2C_TSL, lgI2cReadWordData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CHAN0_LOW));
+			write += i2cResult(I2C_TSL, lgI2cWriteByteData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE, TSL2591_ENABLE_POWEROFF));
+			adcStartTime = 0;
+
+			if(ir >= 0 && full >= 0)
+			{
+				int gain = tslRange.gain();
+				int integration = tslRange.integrationMs();
+				int result = tslRange.addReading(full, ir);
+				if(result == TslAutoRange::TSL_SATURATED)
+				{
+					DEBUGF(INDI::Logger::DBG_DEBUG, "TSL2591 saturated at gain %d, %d ms", gain, integration);
+				}
+				else if(result != TslAutoRange::TSL_REJECTED)
+				{
+					// every integration updates the running estimate
+					uint64_t now = monotonicNs();
+					sqmEstimator.add(tslRange.readingCounts(), tslRange.readingExposure(), now, sqmTimeConstant);
+					if(sqmEstimator.valid())
+					{
+						sample.sqm = 12.6 - 1.086 * log(sqmEstimator.flux() / 29628.0) + sqmOffset + FILTER_COEFF;
+						sample.sqmError = sqmEstimator.magnitudeError();
+						sample.sqmSamples = sqmEstimator.effectiveSamples();
+						sample.sqmValid = true;
+						sample.sqmTime = now;
+					}
+					if(result == TslAutoRange::TSL_READY)
+					{
+						DEBUGF(INDI::Logger::DBG_DEBUG, "SQM %0.2f +/- %0.3f, target reached in %d integrations, last at gain %d, %d ms", sample.sqm, sample.sqmError, tslRange.integrations(), gain, integration);
+					}
+				}
+			}
+		}
+
+		// start the next integration right away with the setting picked from the last reading
+		write += i2cResult(I2C_TSL, lgI2cWriteByteData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CONTROL, tslRange.control()));
+		write += i2cResult(I2C_TSL, lgI2cWriteByteData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE, TSL2591_ENABLE_POWERON | TSL2591_ENABLE_AEN | TSL2591_ENABLE_AIEN));
+		adcStartTime = (write == 0) ? millis() : 0;
+
+		TSLmode = (write == 0) ? TSL_INITIALIZED : TSL_NOTAVAILABLE;
+		available = (write == 0);
+	}	
+	return available;
+}
+
+long int AstroLink4Pi::tslPollPeriod()
+{
+	// wake up when the running integration completes
+	if(TSLmode == TSL_INITIALIZED && adcStartTime != 0)
+		return std::max(adcStartTime + tslRange.integrationMs() + TSL2591_ADC_MARGIN - millis(), 1L);
+
+	return POLL_PERIOD;
+}
+
+bool AstroLink4Pi::readOLD(SensorSnapshot &sample)
+{
+	char i2cData[7];
+	int i2cHandle = getI2cHandle(I2C_OLDSQM);
+	if (i2cHandle >= 0)
+	{
+		int read = i2cResult(I2C_OLDSQM, lgI2cReadDevice(i2cHandle, i2cData, 7));
+		if (read > 6)
+		{
+			int sqm = i2cData[5] * 256 + i2cData[6];
+			sample.sqm = 0.01 * sqm;
+			sample.sqmError = 0;
+			sample.sqmSamples = 1;
+			sample.sqmValid = true;
+			sample.sqmTime = monotonicNs();
+			// DEBUGF(INDI::Logger::DBG_SESSION, "SQM read %i %i", i2cData[5], i2cData[6]);
+			return true;
+		}
+	}	
+	return false;
+}
+
+bool AstroLink4Pi::readMLX(SensorSnapshot &sample)
+{
+	bool MLXavailable = false;
+	int i2cHandle = getI2cHandle(I2C_MLX);
+	if (i2cHandle >= 0)
+	{
+		int Tamb = i2cResult(I2C_MLX, lgI2cReadWordData(i2cHandle, 0x06));
+		int Tobj = i2cResult(I2C_MLX, lgI2cReadWordData(i2cHandle, 0x07));
+		if (Tamb >= 0 && Tobj >= 0)
+		{
+			sample.skyTemperature = 0.02 * Tobj - 273.15;
+			sample.skyDifference = 0.02 * (Tobj - Tamb);
+			sample.ambientTemperature = 0.02 * Tamb - 273.15;
+			MLXavailable = true;
+		}
+		else
+		{
+			DEBUG(INDI::Logger::DBG_DEBUG, "Cannot read data from MLX sensor.");
+		}
+	}
+	else
+	{
+		DEBUG(INDI::Logger::DBG_DEBUG, "No MLX sensor found.");
+	}
+
+	sample.mlxValid = MLXavailable;
+	sample.mlxTime = monotonicNs();
+	return MLXavailable;
+}
+
+bool AstroLink4Pi::readSHT(SensorSnapshot &sample)
+{
+	// periodic measurement commands at high repeatability for 0.5, 1, 2, 4 and 10 mps
+	static const char periodicCommands[5][2] = {{0x20, 0x32}, {0x21, 0x30}, {0x22, 0x36}, {0x23, 0x34}, {0x27, 0x37}};
+	bool SHTavailable = false;
+	uint8_t i2cData[6];
+
+	int i2cHandle = getI2cHandle(I2C_SHT);
+	if (i2cHandle >= 0)
+	{
+		int rate = shtRate;
+		if (shtRunningRate != rate)
+		{
+			// the sensor accepts a new mode only after a break command
+			if (shtRunningRate >= 0)
+			{
+				i2cResult(I2C_SHT, lgI2cWriteDevice(i2cHandle, SHT_CMD_BREAK, 2));
+				usleep(1000);
+			}
+			int written = i2cResult(I2C_SHT, lgI2cWriteDevice(i2cHandle, periodicCommands[rate], 2));
+			shtRunningRate = (written == 0) ? rate : -1;
+			shtFetchFailures = 0;
+			if (written != 0)
+			{
+				DEBUG(INDI::Logger::DBG_DEBUG, "Cannot write data to SHT sensor");
+			}
+			// first result is ready after one measurement period, keep the previous sample until then
+			return written == 0;
+		}
+
+		int written = i2cResult(I2C_SHT, lgI2cWriteDevice(i2cHandle, SHT_CMD_FETCH, 2));
+		int read = (written == 0) ? i2cResult(I2C_SHT, lgI2cReadDevice(i2cHandle, (char *)i2cData, 6)) : written;
+		if (read == 6 && shtCrc(i2cData) == i2cData[2] && shtCrc(i2cData + 3) == i2cData[5])
+		{
+			int temp = i2cData[0] * 256 + i2cData[1];
+			double cTemp = -45.0 + (175.0 * temp / 65535.0);
+			double humidity = 100.0 * (i2cData[3] * 256.0 + i2cData[4]) / 65535.0;
+
+			double a = 17.271;
+			double b = 237.7;
+			double tempAux = (a * cTemp) / (b + cTemp) + log(humidity * 0.01);
+			double Td = (b * tempAux) / (a - tempAux);
+
+			sample.temperature = cTemp;
+			sample.humidity = humidity;
+			sample.dewPoint = Td;
+			shtFetchFailures = 0;
+			SHTavailable = true;
+		}
+		else
+		{
+			if (read == 6)
+			{
+				DEBUG(INDI::Logger::DBG_DEBUG, "SHT sensor data CRC error.");
+			}
+			else
+			{
+				// NACK while no new measurement is ready
+				DEBUG(INDI::Logger::DBG_DEBUG, "Cannot read data from SHT sensor");
+			}
+
+			// a single failure keeps the previous sample, repeated ones mean the sensor may have been power cycled
+			if (++shtFetchFailures < SHT_FETCH_FAILURES)
+				return false;
+
+			DEBUG(INDI::Logger::DBG_DEBUG, "Restarting SHT periodic measurement");
+			shtRunningRate = -1;
+			shtFetchFailures = 0;
+		}
+	}
+	else
+	{
+		DEBUG(INDI::Logger::DBG_DEBUG, "No SHT sensor found.");
+	}
+
+	sample.shtValid = SHTavailable;
+	sample.shtTime = monotonicNs();
+	return SHTavailable;
+}
+
+void AstroLink4Pi::stopSHT()
+{
+	if (shtRunningRate >= 0 && i2cDevices[I2C_SHT].handle >= 0)
+	{
+		i2cResult(I2C_SHT, lgI2cWriteDevice(i2cDevices[I2C_SHT].handle, SHT_CMD_BREAK, 2));
+	}
+	shtRunningRate = -1;
+}
+
+uint8_t AstroLink4Pi::shtCrc(const uint8_t *data)
+{
+	// CRC-8, polynomial 0x31, init 0xFF over one 16-bit word
+	uint8_t crc = 0xFF;
+	for (int i = 0; i < 2; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+bool AstroLink4Pi::readPower(SensorSnapshot &sample)
+{
+	if (revision < 4)
+		return false;
+
+	// collect the latest results of the scan sequencer
+	uint64_t total = 0;
+	PowerSample latest;
+	for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+	{
+		total += adcRing[channel].total();
+		if (adcRing[channel].latest(latest))
+			sample.adcChannel[channel] = latest.value;
+	}
+	if (total == powerSamplesSeen && sample.powerValid == powerScanOk)
+		return sample.powerValid;
+
+	sample.vin = sample.adcChannel[ADC_VIN];
+	sample.vreg = sample.adcChannel[ADC_VREG];
+	sample.itot = sample.adcChannel[ADC_IREAL];
+	sample.energyAs = energyAs;
+	sample.energyWs = energyWs;
+	sample.lifetimeAs = lifetimeAs;
+	sample.lifetimeWs = lifetimeWs;
+	sample.chargeAs = chargeAs;
+	sample.adcRate = adcScanRate;
+	sample.powerValid = powerScanOk;
+	sample.powerTime = monotonicNs();
+	powerSamplesSeen = total;
+	return sample.powerValid;
+}
+
+bool AstroLink4Pi::adcConvert(int i2cHandle, int channel, int rateIndex, bool continuous, int &continuousChannel, int16_t &raw)
+{
+	// a continuously converting channel needs no config writes
+	if (!continuous || continuousChannel != channel)
+	{
+		uint16_t config = adcConfig(channel, rateIndex, continuous);
+		char writeBuf[3] = {0x01, (char)(config >> 8), (char)(config & 0xFF)};
+		if (i2cResult(I2C_ADC, lgI2cWriteDevice(i2cHandle, writeBuf, 3)) != 0)
+		{
+			DEBUG(INDI::Logger::DBG_DEBUG, "Cannot write data to power sensor");
+			continuousChannel = -1;
+			return false;
+		}
+		continuousChannel = continuous ? channel : -1;
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(adcConversionTime(rateIndex)));
+
+	// in single shot mode the OS bit tells when the conversion is done
+	if (!continuous)
+	{
+		for (int poll = 0; poll < ADC_READY_POLLS; poll++)
+		{
+			int config = i2cResult(I2C_ADC, lgI2cReadWordData(i2cHandle, 0x01));
+			if (config < 0 || (config & 0x80))
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(ADC_READY_WAIT));
+		}
+	}
+
+	int word = i2cResult(I2C_ADC, lgI2cReadWordData(i2cHandle, 0x00));
+	if (word < 0)
+	{
+		DEBUG(INDI::Logger::DBG_DEBUG, "Cannot read data from power sensor");
+		return false;
+	}
+	raw = adcDecode(word);
+	return true;
+}
+
+void AstroLink4Pi::powerLoop()
+{
+	std::vector<int> sequence;
+	size_t slot = 0;
+	int continuousChannel = -1;
+	int rateIndex = 0;
+	PowerSample lastCurrent;
+	double lastPower = 0;
+	long int rateStart = millis();
+	long rateCount = 0;
+	double zeroSum = 0;
+	int zeroCount = 0;
+	bool wasCapturing = false;
+	bool lastMonitor = false;
+
+	while (!_powerStop)
+	{
+		if (powerScanChanged.exchange(false))
+		{
+			int weights[ADC_CHANNEL_COUNT];
+			for (int channel = 0; channel < ADC_CHANNEL_COUNT; channel++)
+				weights[channel] = adcWeights[channel];
+			// zero current calibration needs the current channel
+			if (zeroRequest && weights[ADC_IREAL] == 0)
+				weights[ADC_IREAL] = 1;
+			sequence = buildScanSequence(weights, ADC_CHANNEL_COUNT);
+			rateIndex = adcRate;
+			slot = 0;
+			continuousChannel = -1;
+		}
 
-	if (chan == 0)
-		chanBits = 0x30;
-	else
-		chanBits = 0xB0;
+		// a capture takes the ADC over for one channel at the fastest rate
+		bool capturing = captureActive;
+		int captureChannel = 0;
+		if (capturing)
+		{
+			std::lock_guard<std::mutex> lock(captureMutex);
+			captureChannel = capture.channel();
+		}
+		if (capturing != wasCapturing)
+		{
+			continuousChannel = -1;
+			captureVinGap = 0;
+		}
+		wasCapturing = capturing;
 
-	chanBits |= ((value >> 4) & 0x0F);
-	dataBits = ((value << 4) & 0xF0);
+		int i2cHandle = getI2cHandle(I2C_ADC);
+		if ((sequence.empty() && !capturing) || i2cHandle < 0)
+		{
+			if (i2cHandle < 0)
+			{
+				DEBUG(INDI::Logger::DBG_DEBUG, "No power sensor found.");
+			}
+			powerScanOk = false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD));
+			continue;
+		}
 
-	spiData[0] = chanBits;
-	spiData[1] = dataBits;
+		int channel = captureChannel;
+		bool continuous = true;
+		int conversionRate = ADC_RATE_COUNT - 1;
+		int oversample = 1;
+		if (capturing)
+		{
+			// Vin and Ireal are still converted as often as the scan did, so brownout protection,
+			// energy and battery counting carry on while the capture holds the ADC. Monitor samples
+			// are taken two conversions early so the gap does not grow, and never back to back.
+			double period = (vinIntervalMax > 0) ? vinIntervalMax.load() : CAPTURE_MONITOR_PERIOD;
+			uint64_t due = monotonicNs() + 2 * adcConversionTime(conversionRate) * 1000;
+			int monitored[2] = {ADC_VIN, ADC_IREAL};
+			for (int monitor : monitored)
+			{
+				PowerSample last;
+				if (lastMonitor || monitor == captureChannel)
+					continue;
+				if (!adcRing[monitor].latest(last) || (due - last.time) / 1e6 >= period)
+				{
+					channel = monitor;
+					break;
+				}
+			}
+			lastMonitor = (channel != captureChannel);
+		}
+		else
+		{
+			channel = sequence[slot];
+			slot = (slot + 1) % sequence.size();
+			continuous = (sequence.size() == 1);
+			conversionRate = rateIndex;
+			oversample = std::min(std::max((int)adcOversample, 1), ADC_MAX_OVERSAMPLE);
+		}
 
-	int spiHandle = lgSpiOpen(pigpioHandle, 1, 100000, 0);
-	int written = lgSpiWrite(spiHandle, spiData, 2);
-	lgSpiClose(spiHandle);
+		// oversample the slot and reduce it to one sample
+		int16_t raw[ADC_MAX_OVERSAMPLE];
+		int count = 0;
+		while (count < oversample && adcConvert(i2cHandle, channel, conversionRate, continuous, continuousChannel, raw[count]))
+			count++;
+		if (count < oversample)
+		{
+			powerScanOk = false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD));
+			continue;
+		}
+		double volts = adcReduce(raw, count, adcFilterMode) / 32768.0 * 4.096;
+
+		PowerSample sample;
+		sample.time = monotonicNs();
+		sample.value = volts * adcGain[channel] - adcOffset[channel];
+		adcRing[channel].push(sample);
+		powerScanOk = true;
+		if (capturing && channel == captureChannel)
+		{
+			std::lock_guard<std::mutex> lock(captureMutex);
+			uint64_t event = captureEvent.exchange(0);
+			if (event != 0)
+				capture.trigger(event);
+			if (capture.add(sample.value, sample.time))
+			{
+				captureActive = false;
+				captureDone = true;
+				powerScanChanged = true;
+			}
+		}
+		bool statsFlushed = false;
+		if (channel == ADC_VIN)
+			statsFlushed |= powerStats.add(STATS_VIN, sample.value, sample.time);
+		else if (channel == ADC_VREG)
+			statsFlushed |= powerStats.add(STATS_VREG, sample.value, sample.time);
+		else if (channel == ADC_IREAL)
+			statsFlushed |= powerStats.add(STATS_ITOT, sample.value, sample.time);
+		if (channel == ADC_VIN || channel == ADC_IREAL)
+			brownoutCheck(channel, sample);
+
+		if (channel == ADC_IREAL)
+		{
+			if (zeroRequest)
+			{
+				zeroSum += volts * adcGain[channel];
+				if (++zeroCount >= ADC_ZERO_SAMPLES)
+				{
+					zeroOffset = zeroSum / zeroCount;
+					zeroRequest = false;
+					zeroDone = true;
+					powerScanChanged = true;
+					zeroSum = 0;
+					zeroCount = 0;
+				}
+			}
 
-	return written;
-}
+			// trapezoidal integration between consecutive current samples
+			PowerSample vin;
+			adcRing[ADC_VIN].latest(vin);
+			double power = vin.value * sample.value;
+			if (lastCurrent.time != 0)
+			{
+				double dt = (sample.time - lastCurrent.time) / 1e9;
+				double charge = (lastCurrent.value + sample.value) / 2 * dt;
+				double energy = (lastPower + power) / 2 * dt;
+				energyAs = energyAs + charge;
+				energyWs = energyWs + energy;
+				lifetimeAs = lifetimeAs + charge;
+				chargeAs = chargeAs + charge;
+				lifetimeWs = lifetimeWs + energy;
+			}
+			lastCurrent = sample;
+			lastPower = power;
+			{
+				std::lock_guard<std::mutex> lock(loadMutex);
+				loadModel.addSample(sample.value, vin.value, sample.time);
+			}
+			statsFlushed |= powerStats.add(STATS_PTOT, power, sample.time);
+		}
 
-void AstroLink4Pi::fanUpdate()
-{
-	FanPowerNP.s = IPS_BUSY;
-	int fanPinAvailable = lgGpioClaimOutput(pigpioHandle, 0, FAN_PIN, 0);
-	if (fanPinAvailable == 0)
-	{
-		int temp = std::stoi(SysInfoT[SYSI_CPUTEMP].text);
-		int cycle = 0;
-		double fanPwr = 33.0;
-		if (temp > 65)
+		if (powerStatsReset.exchange(false))
+		{
+			powerStats.reset();
+			statsFlushed = true;
+		}
+		if (statsFlushed)
+			powerStatsSnapshot.publish(powerStats.snapshot());
+
+		// counters are only written by this thread, resets are requested by the INDI thread
+		int reset = energyReset.exchange(0);
+		if (reset & ENERGY_RESET_SESSION)
 		{
-			cycle = 50;
-			fanPwr = 66.0;
+			energyAs = energyWs = 0;
+			std::lock_guard<std::mutex> lock(loadMutex);
+			loadModel.resetEnergy();
 		}
-		if (temp > 70)
+		if (reset & ENERGY_RESET_LIFETIME)
+			lifetimeAs = lifetimeWs = 0;
+
+		rateCount++;
+		long int timeMillis = millis();
+		if (timeMillis - rateStart >= 1000)
 		{
-			cycle = 100;
-			fanPwr = 100.0;
+			adcScanRate = rateCount * 1000.0 / (timeMillis - rateStart);
+			rateStart = timeMillis;
+			rateCount = 0;
 		}
-		lgTxPwm(pigpioHandle, FAN_PIN, 100, cycle, 0, 0);
-		FanPowerN[0].value = fanPwr;
-		FanPowerNP.s = IPS_OK;
 	}
-	else
+
+	// back to single shot mode, which powers the ADC down between conversions
+	int i2cHandle = i2cDevices[I2C_ADC].handle;
+	if (continuousChannel >= 0 && i2cHandle >= 0)
 	{
-		FanPowerNP.s = IPS_ALERT;
-		DEBUGF(INDI::Logger::DBG_SESSION, "GPIO fan pin not available %d\n", fanPinAvailable);
+		uint16_t config = adcConfig(continuousChannel, rateIndex, false) & 0x7FFF;
+		char writeBuf[3] = {0x01, (char)(config >> 8), (char)(config & 0xFF)};
+		i2cResult(I2C_ADC, lgI2cWriteDevice(i2cHandle, writeBuf, 3));
 	}
-	IDSetNumber(&FanPowerNP, nullptr);
 }
 
-bool AstroLink4Pi::readSQM(bool triggerOldSensor)
+void AstroLink4Pi::publishPowerStats()
 {
-	SQMavailable = readTSL() || (triggerOldSensor && readOLD());
-	return SQMavailable;
-}
+	PowerStatsSnapshot stats;
+	if (!powerStatsSnapshot.read(stats))
+		return;
 
-bool AstroLink4Pi::readTSL()
-{
-	bool available = false;
-	int i2cHandle = lgI2cOpen(1, TSL2591_ADDR, 0);
-	
-	if(i2cHandle < 0)
+	// the last minute peak belongs to a phase mode once the PWM settings held for the whole minute,
+	// it is only the highest scanned sample, an Ireal capture gives the exact figure
+	if (millis() - pwmPhaseSince >= PWM_PEAK_SETTLE && stats.valid[STATS_ITOT][STATS_1MIN])
 	{
-		TSLmode = TSL_NOTAVAILABLE;
-		return false;
+		int peak = pwmInterleaved ? PWM_PEAK_INTERLEAVED : PWM_PEAK_ALIGNED;
+		PwmPeakN[peak].value = stats.value[STATS_ITOT][STATS_1MIN][STATS_MAX];
 	}
-	
-	if(TSLmode == TSL_NOTAVAILABLE) 
 	{
-		int write = lgI2cWriteByte(i2cHandle, 0x80 | 0x20 | 0x12);
-		if(write == 0) {
-			TSLmode = TSL_AVAILABLE;
-			available = true;
+		std::lock_guard<std::mutex> lock(outputMutex);
+		PwmPeakN[PWM_OVERLAP].value = pwmOverlapFraction * 100;
+	}
+	PwmPeakNP.s = IPS_OK;
+	IDSetNumber(&PwmPeakNP, nullptr);
+
+	for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+	{
+		bool valid = false;
+		for (int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+		{
+			for (int stat = 0; stat < STATS_VALUE_COUNT; stat++)
+				PowerStatsN[window][channel * STATS_VALUE_COUNT + stat].value = stats.value[channel][window][stat];
+			valid |= stats.valid[channel][window];
 		}
+		PowerStatsNP[window].s = valid ? IPS_OK : IPS_IDLE;
+		IDSetNumber(&PowerStatsNP[window], nullptr);
 	}
-	else if(TSLmode == TSL_AVAILABLE)
+}
+
+void AstroLink4Pi::captureUpdate()
+{
+	if (!captureDone.exchange(false))
+		return;
+
+	std::lock_guard<std::mutex> lock(captureMutex);
+	if (capture.state() != CAPTURE_DONE)
+		return;
+	captureBlob = capture.encode();
+	CaptureB[0].blob = captureBlob.data();
+	CaptureB[0].bloblen = CaptureB[0].size = captureBlob.size();
+	CaptureBP.s = IPS_OK;
+	IDSetBLOB(&CaptureBP, nullptr);
+	CaptureSP.s = IPS_OK;
+	IDSetSwitch(&CaptureSP, nullptr);
+
+	// an Ireal capture over unchanged heater settings gives the real peak of the phase mode
+	if (capture.channel() == ADC_IREAL && pwmPhaseSince == capturePhaseSince)
 	{
-		int write = lgI2cWriteByte(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE);
-        write += lgI2cWriteByte(i2cHandle, TSL2591_ENABLE_POWERON | TSL2591_ENABLE_AEN | TSL2591_ENABLE_AIEN);
+		PwmPeakN[pwmInterleaved ? PWM_CAPTURE_INTERLEAVED : PWM_CAPTURE_ALIGNED].value = capture.maximum();
+		IDSetNumber(&PwmPeakNP, nullptr);
+	}
 
-		// Enable device - power down mode on boot
-        write += lgI2cWriteByte(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CONTROL); 
-        write += lgI2cWriteByte(i2cHandle, 0x05 | 0x30); 
-        
-        write += lgI2cWriteByte(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE); 
-        write += lgI2cWriteByte(i2cHandle, TSL2591_ENABLE_POWEROFF); 
-        
-		TSLmode = (write == 0) ? TSL_INITIALIZED : TSL_NOTAVAILABLE;
-		available = (write == 0);
+	// the capture must not have widened the input voltage sample gap the brownout bound relies on
+	if (capture.channel() != ADC_VIN && vinIntervalMax > 0 && captureVinGap > vinIntervalMax * 1.5)
+	{
+		DEBUGF(INDI::Logger::DBG_WARNING, "Vin was sampled every %0.1f ms during the capture, the scan bound is %0.1f ms.", captureVinGap.load(), vinIntervalMax.load());
 	}
-	else if(TSLmode == TSL_INITIALIZED)
+	DEBUGF(INDI::Logger::DBG_SESSION, "Capture of %s done, %d bytes", CaptureChannelS[capture.channel()].label, (int)captureBlob.size());
+}
+
+void AstroLink4Pi::brownoutCheck(int channel, const PowerSample &sample)
+{
+	// worst gap between input voltage samples over the last two windows bounds the detection time
+	if (channel == ADC_VIN)
 	{
-		if(adcStartTime == 0)
+		if (brownout.lastVin != 0)
 		{
-			int write = lgI2cWriteByte(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE);
-			write += lgI2cWriteByte(i2cHandle, TSL2591_ENABLE_POWERON | TSL2591_ENABLE_AEN | TSL2591_ENABLE_AIEN);	
-			adcStartTime = millis();
-			TSLmode = (write == 0) ? TSL_INITIALIZED : TSL_NOTAVAILABLE;
-			available = (write == 0);
+			double interval = (sample.time - brownout.lastVin) / 1e6;
+			brownout.vinInterval = std::max(brownout.vinInterval, interval);
+			if (captureActive)
+				captureVinGap = std::max(captureVinGap.load(), interval);
 		}
-		else if(millis() > (adcStartTime + TSL2591_ADC_TIME))
+		if ((sample.time - brownout.windowStart) / 1e6 >= BROWNOUT_INTERVAL_WINDOW)
 		{
-			int ir = lgI2cReadWordData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CHAN1_LOW);
-			int full = lgI2cReadWordData(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_CHAN0_LOW);
+			vinIntervalMax = std::max(brownout.vinInterval, brownout.previousInterval);
+			brownout.previousInterval = brownout.vinInterval;
+			brownout.vinInterval = 0;
+			brownout.windowStart = sample.time;
+		}
+		brownout.lastVin = sample.time;
+		brownout.vin = sample.value;
+	}
+	else
+	{
+		brownout.itot = sample.value;
+	}
+
+	if (!brownoutEnabled)
+	{
+		if (shedMask != 0)
+			restoreLoads(ALL_LOADS, sample.time);
+		brownout.violations = 0;
+		return;
+	}
 
-	        int write = lgI2cWriteByte(i2cHandle, TSL2591_COMMAND_BIT | TSL2591_REGISTER_ENABLE); 
-			write += lgI2cWriteByte(i2cHandle, TSL2591_ENABLE_POWEROFF); 	
-			adcStartTime = 0;	
+	bool violation = (brownout.vin < brownoutVinMin) || (brownout.itot > brownoutItotMax);
+	bool healthy = (brownout.vin >= brownoutVinMin + brownoutHysteresis) && (brownout.itot < brownoutItotMax * 0.9);
 
-			int visCumulative = fullCumulative - irCumulative;
-			if(full < ir) return true;
-			if(niter < 5 || (visCumulative < 500 && niter < 150))
+	if (violation)
+	{
+		brownout.healthySince = 0;
+		if (brownout.violations++ == 0)
+			brownout.firstViolation = sample.time;
+		if (brownout.violations < BROWNOUT_DEBOUNCE)
+			return;
+
+		// shed the next stage right away on a new trip, later stages after a delay
+		if (shedMask == 0 || (sample.time - brownout.lastShed) / 1e6 >= BROWNOUT_STAGE_DELAY)
+		{
+			// reaction is measured from the end of the first out of range conversion
+			int load = nextShedLoad(true);
+			if (load >= 0)
 			{
-				niter++;
-				fullCumulative += full;
-				irCumulative += ir;
+				shedLoad(load, (shedMask == 0) ? brownout.firstViolation : sample.time);
+				brownout.lastShed = monotonicNs();
 			}
-			else
-			{
-				double VIS = (double) visCumulative / (29628.0 * niter);
-				double mpsas = 12.6 - 1.086 * log(VIS) + SQMOffsetN[0].value + FILTER_COEFF;
-				setParameterValue("SQM_READING", mpsas);
-				
-				niter = 0;
-				irCumulative = fullCumulative = 0;
-			}	
-
-			TSLmode = (write == 0) ? TSL_INITIALIZED : TSL_NOTAVAILABLE;
-			available = (write == 0);
 		}
-	}	
-	lgI2cClose(i2cHandle);
-	return available;
+		return;
+	}
+
+	brownout.violations = 0;
+	if (shedMask == 0 || !healthy)
+		return;
+
+	// restore one stage at a time once the supply has recovered for a while
+	if (brownout.healthySince == 0)
+		brownout.healthySince = sample.time;
+	if ((sample.time - brownout.healthySince) / 1e9 >= brownoutRestoreDelay && (sample.time - brownout.lastRestore) / 1e9 >= BROWNOUT_RESTORE_STEP)
+	{
+		int load = nextShedLoad(false);
+		if (load >= 0)
+			restoreLoads(1 << load, sample.time);
+		brownout.lastRestore = sample.time;
+	}
 }
 
-bool AstroLink4Pi::readOLD()
+int AstroLink4Pi::nextShedLoad(bool shed)
 {
-	char i2cData[7];
-	int i2cHandle = lgI2cOpen(1, 0x33, 0);
-	if (i2cHandle >= 0)
+	// lowest priority number is shed first and restored last, 0 is never shed
+	int best = -1;
+	for (int load = 0; load < LOAD_COUNT; load++)
 	{
-		int read = lgI2cReadDevice(i2cHandle, i2cData, 7);
-		lgI2cClose(i2cHandle);
-		if (read > 6)
+		int priority = shedPriority[load];
+		bool isShed = shedMask & (1 << load);
+		if (priority <= 0 || isShed == shed)
+			continue;
+		if (best < 0 || (shed ? priority < shedPriority[best] : priority > shedPriority[best]))
+			best = load;
+	}
+	return best;
+}
+
+void AstroLink4Pi::shedLoad(int load, uint64_t detected)
+{
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		shedMask |= (1 << load);
+		applyOutput(load);
+	}
+
+	// the motor hold is dropped here unless a move is stepping, then the move is stopped at the
+	// next step and the motion thread drops the driver and logs the event
+	if (load == LOAD_MOTOR)
+	{
+		std::lock_guard<std::mutex> lock(motorMutex);
+		motorHoldShed = true;
+		if (motorStepping)
 		{
-			int sqm = i2cData[5] * 256 + i2cData[6];
-			setParameterValue("SQM_READING", 0.01 * sqm);
-			// DEBUGF(INDI::Logger::DBG_SESSION, "SQM read %i %i", i2cData[5], i2cData[6]);
-			return true;
+			motorShedEvent = {load, true, detected, brownout.vin, brownout.itot, 0};
+			motorShedPending = true;
+			_abort = true;
+			return;
 		}
-	}	
-	return false;
+		lgGpioWrite(pigpioHandle, EN_PIN, 1);
+		driveMotor(0);
+	}
+	uint64_t done = monotonicNs();
+	pushShedEvent(load, true, detected, done);
 }
 
-bool AstroLink4Pi::readMLX()
+void AstroLink4Pi::restoreLoads(int mask, uint64_t detected)
 {
-	int i2cHandle = lgI2cOpen(1, 0x5A, 0);
-	if (i2cHandle >= 0)
+	for (int load = 0; load < LOAD_COUNT; load++)
 	{
-		int Tamb = lgI2cReadWordData(i2cHandle, 0x06);
-		int Tobj = lgI2cReadWordData(i2cHandle, 0x07);
-		lgI2cClose(i2cHandle);
-		if (Tamb >= 0 && Tobj >= 0)
+		if (!(mask & shedMask & (1 << load)))
+			continue;
 		{
-			setParameterValue("WEATHER_SKY_TEMP", 0.02 * Tobj - 273.15);
-			setParameterValue("WEATHER_SKY_DIFF", 0.02 * (Tobj - Tamb));
-			if (!SHTavailable)
-				focuserTemperature = 0.02 * Tamb - 273.15;
-			MLXavailable = true;
+			std::lock_guard<std::mutex> lock(outputMutex);
+			shedMask &= ~(1 << load);
+			applyOutput(load);
 		}
-		else
+		if (load == LOAD_MOTOR)
 		{
-			DEBUG(INDI::Logger::DBG_DEBUG, "Cannot read data from MLX sensor.");
-			MLXavailable = false;
+			// a move or homing in progress applies the hold when it ends
+			std::lock_guard<std::mutex> lock(motorMutex);
+			motorHoldShed = false;
+			motorShedPending = false;
+			if (!motorActive)
+				driveHold();
 		}
+		pushShedEvent(load, false, detected, monotonicNs());
 	}
-	else
-	{
-		DEBUG(INDI::Logger::DBG_DEBUG, "No MLX sensor found.");
-		MLXavailable = false;
-	}
+}
 
-	if (!MLXavailable)
-	{
-		setParameterValue("WEATHER_SKY_TEMP", 0.0);
-		setParameterValue("WEATHER_SKY_DIFF", 0.0);
-	}
+void AstroLink4Pi::pushShedEvent(int load, bool shed, uint64_t detected, uint64_t done)
+{
+	ShedEvent event;
+	event.load = load;
+	event.shed = shed;
+	event.time = detected;
+	event.vin = brownout.vin;
+	event.itot = brownout.itot;
+	queueShedEvent(event, done);
+}
 
-	return MLXavailable;
+void AstroLink4Pi::queueShedEvent(ShedEvent event, uint64_t done)
+{
+	// reaction time from detection until the load was switched
+	event.latency = (done - event.time) / 1e6;
+	event.time = done;
+
+	std::lock_guard<std::mutex> lock(shedEventMutex);
+	if (shedEvents.size() < SHED_EVENT_QUEUE)
+		shedEvents.push_back(event);
 }
 
-bool AstroLink4Pi::readSHT()
+void AstroLink4Pi::brownoutUpdate()
 {
-	char i2cData[6];
-	char i2cWrite[2];
+	std::vector<ShedEvent> events;
+	{
+		std::lock_guard<std::mutex> lock(shedEventMutex);
+		events.swap(shedEvents);
+	}
 
-	int i2cHandle = lgI2cOpen(1, 0x44, 0);
-	if (i2cHandle >= 0)
+	const char *loadNames[LOAD_COUNT] = {"PWM 1", "PWM 2", "OUT 1", "OUT 2", "motor hold"};
+	uint64_t now = monotonicNs();
+	for (const ShedEvent &event : events)
 	{
-		i2cWrite[0] = 0x24;
-		i2cWrite[1] = 0x00;
-		int written = lgI2cWriteDevice(i2cHandle, i2cWrite, 2);
-		if (written == 0)
+		// monotonic event time to wall clock
+		time_t wall = time(nullptr) - (time_t)((now - event.time) / 1000000000ULL);
+		char ts[32];
+		strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&wall));
+		if (event.shed)
 		{
-			usleep(30000);
-			int read = lgI2cReadDevice(i2cHandle, i2cData, 6);
-
-			if (read > 4)
-			{
-				int temp = i2cData[0] * 256 + i2cData[1];
-				double cTemp = -45.0 + (175.0 * temp / 65535.0);
-				double humidity = 100.0 * (i2cData[3] * 256.0 + i2cData[4]) / 65535.0;
-
-				double a = 17.271;
-				double b = 237.7;
-				double tempAux = (a * cTemp) / (b + cTemp) + log(humidity * 0.01);
-				double Td = (b * tempAux) / (a - tempAux);
-
-				setParameterValue("WEATHER_TEMPERATURE", cTemp);
-				setParameterValue("WEATHER_HUMIDITY", humidity);
-				setParameterValue("WEATHER_DEWPOINT", Td);
-				focuserTemperature = cTemp;
-				SHTavailable = true;
-			}
+			DEBUGF(INDI::Logger::DBG_WARNING, "%s.%03d %s shed, Vin %0.2f V, Itot %0.2f A, reaction %0.1f ms", ts, (int)(event.time / 1000000 % 1000),
+				   loadNames[event.load], event.vin, event.itot, event.latency);
+			BrownoutStatusN[BROWNOUT_LAST_LATENCY].value = event.latency;
+			BrownoutStatusN[BROWNOUT_MAX_LATENCY].value = std::max(BrownoutStatusN[BROWNOUT_MAX_LATENCY].value, event.latency);
 		}
 		else
 		{
-			DEBUG(INDI::Logger::DBG_DEBUG, "Cannot write data to SHT sensor");
-			SHTavailable = false;
+			DEBUGF(INDI::Logger::DBG_SESSION, "%s.%03d %s restored, Vin %0.2f V, Itot %0.2f A", ts, (int)(event.time / 1000000 % 1000),
+				   loadNames[event.load], event.vin, event.itot);
 		}
-		lgI2cClose(i2cHandle);
-	}
-	else
-	{
-		DEBUG(INDI::Logger::DBG_DEBUG, "No SHT sensor found.");
-		SHTavailable = false;
 	}
 
-	if (!SHTavailable)
+
+	// detection takes BROWNOUT_DEBOUNCE input voltage samples
+	double bound = BROWNOUT_DEBOUNCE * vinIntervalMax;
+	int shedCount = 0;
+	for (int load = 0; load < LOAD_COUNT; load++)
+		shedCount += (shedMask & (1 << load)) ? 1 : 0;
+	if (events.empty() && shedCount == BrownoutStatusN[BROWNOUT_SHED].value && fabs(bound - BrownoutStatusN[BROWNOUT_BOUND].value) < 1)
+		return;
+
+	if (brownoutEnabled && bound > BROWNOUT_MAX_LATENCY && BrownoutStatusN[BROWNOUT_BOUND].value <= BROWNOUT_MAX_LATENCY)
 	{
-		setParameterValue("WEATHER_TEMPERATURE", 0.0);
-		setParameterValue("WEATHER_HUMIDITY", 0.0);
-		setParameterValue("WEATHER_DEWPOINT", 0.0);
+		DEBUGF(INDI::Logger::DBG_WARNING, "Brownout detection may take %0.0f ms, raise the ADC rate or the Vin scan weight.", bound);
 	}
-	return SHTavailable;
+	BrownoutStatusN[BROWNOUT_SHED].value = shedCount;
+	BrownoutStatusN[BROWNOUT_BOUND].value = bound;
+	BrownoutStatusNP.s = (shedCount > 0) ? IPS_ALERT : IPS_OK;
+	IDSetNumber(&BrownoutStatusNP, nullptr);
 }
 
-bool AstroLink4Pi::readPower()
+bool AstroLink4Pi::startProfile(int profile)
 {
-	if (revision < 4)
+	std::vector<ProfileStep> steps;
+	std::string error;
+	if (!parsePowerProfile(PowerProfilesT[profile].text, steps, error))
+	{
+		DEBUGF(INDI::Logger::DBG_ERROR, "Power profile %s: %s", PowerProfilesT[profile].label, error.c_str());
+		return false;
+	}
+	if (steps.empty())
 		return false;
 
-	char writeBuf[3];
-	char readBuf[2];
-
-	int i2cHandle = lgI2cOpen(1, 0x48, 0);
-	if (i2cHandle >= 0)
+	stopProfileThread();
 	{
-		/*
-		powerIndex 0-1 Vin WR, 2-3 Vreg WR, 4-5 Itot WR
+		// only the startup profile holds outputs back
+		std::lock_guard<std::mutex> lock(outputMutex);
+		int held = profileHold;
+		profileHold = (profile == PROFILE_STARTUP) ? profileOutputs(steps) : 0;
+		for (int load = LOAD_PWM1; load <= LOAD_OUT2; load++)
+		{
+			if ((held ^ profileHold) & (1 << load))
+				applyOutput(load);
+		}
+	}
+	DEBUGF(INDI::Logger::DBG_SESSION, "Power profile %s started, %d steps", PowerProfilesT[profile].label, (int)steps.size());
+	_profileStop = false;
+	_profileThread = std::thread(&AstroLink4Pi::profileLoop, this, steps, profile);
+	return true;
+}
 
-		15 		- 1 	start single conv
-		14:12	- 100 	Vin, 101 Vreg, 110 Itot, 111 Iref, 011 Ireal
-		11:9  	- 001	+-4.096V
-		8		- 1 single
+void AstroLink4Pi::stopProfileThread()
+{
+	if (_profileThread.joinable())
+	{
+		_profileStop = true;
+		_profileThread.join();
+	}
+}
 
-		7:5		- 010 32SPS, 011 64SPS, 001 16SPS
-		4:2		- 000 comparator
-		1:0		- 11 comparator disable
-		*/
+void AstroLink4Pi::profileLoop(std::vector<ProfileStep> steps, int profile)
+{
+	const char *outputNames[PROFILE_OUTPUT_COUNT] = {"PWM 1", "PWM 2", "OUT 1", "OUT 2"};
+	for (const ProfileStep &step : steps)
+	{
+		if (_profileStop)
+			break;
 
-		writeBuf[0] = 0x01;
-		writeBuf[1] = 0b11000011;
-		writeBuf[2] = 0b00100011;
-		if ((powerIndex % 2) == 0) // Trigger conversion
+		if (step.type == PROFILE_STEP_OUTPUT)
 		{
-			switch (powerIndex)
-			{
-			case 0:
-				writeBuf[1] = 0b11000011;
-				break;
-			case 2:
-				writeBuf[1] = 0b11010011;
-				break;
-			case 4:
-				writeBuf[1] = 0b10110011;
-				break;
-			}
-			int written = lgI2cWriteDevice(i2cHandle, writeBuf, 3);
-			if (written != 0)
 			{
-				DEBUG(INDI::Logger::DBG_DEBUG, "Cannot write data to power sensor");
-				PowerReadingsNP.s = IPS_ALERT;
+				std::lock_guard<std::mutex> lock(outputMutex);
+				if (step.output == PROFILE_PWM1 || step.output == PROFILE_PWM2)
+					pwmState[step.output - PROFILE_PWM1] = step.value;
+				else
+					relayState[step.output - PROFILE_OUT1] = (int)step.value;
+				profileHold &= ~(1 << step.output);
+				applyOutput(step.output);
 			}
+			profileOutputsChanged = true;
+			DEBUGF(INDI::Logger::DBG_SESSION, "Power profile: %s set to %0.0f", outputNames[step.output], step.value);
 		}
-		else // Trigger read
+		else if (step.type == PROFILE_STEP_DELAY)
 		{
-			PowerReadingsNP.s = IPS_BUSY;
-
-			writeBuf[0] = 0x00;
-			int written = lgI2cWriteDevice(i2cHandle, writeBuf, 1);
-			if (written == 0)
+			long int until = millis() + step.timeout;
+			while (!_profileStop && millis() < until)
+				std::this_thread::sleep_for(std::chrono::milliseconds(std::min(50L, until - millis() + 1)));
+		}
+		else if (step.type == PROFILE_STEP_SETTLE)
+		{
+			if (revision < 4)
 			{
-				int read = lgI2cReadDevice(i2cHandle, readBuf, 2);
-				if (read > 0)
-				{
-					int16_t val = readBuf[0] * 255 + readBuf[1];
-
-					switch (powerIndex)
-					{
-					case 1:
-						PowerReadingsN[POW_VIN].value = (float)val / 32768.0 * 4.096 * 6.6;
-						break;
-					case 3:
-						PowerReadingsN[POW_VREG].value = (float)val / 32768.0 * 4.096 * 6.6;
-						break;
-					case 5:
-						PowerReadingsN[POW_ITOT].value = (float)val / 32768.0 * 4.096 * 1 * ((ACS_TYPE == 0) ? 20 : 10.8);
-						break;
-					}
-					PowerReadingsN[POW_PTOT].value = PowerReadingsN[POW_VIN].value * PowerReadingsN[POW_ITOT].value;
-					energyAs += PowerReadingsN[POW_ITOT].value * 0.4;
-					energyWs += PowerReadingsN[POW_VIN].value * PowerReadingsN[POW_ITOT].value * 0.4;
-					PowerReadingsN[POW_AH].value = energyAs / 3600;
-					PowerReadingsN[POW_WH].value = energyWs / 3600;
-
-					PowerReadingsNP.s = IPS_OK;
-				}
-				else
+				DEBUG(INDI::Logger::DBG_DEBUG, "Power profile: no current monitor, settle step skipped");
+				continue;
+			}
+			// averaged over several heater PWM periods
+			SettleDetector settle(std::max((uint64_t)PROFILE_SETTLE_AVERAGE_NS, (uint64_t)(PROFILE_SETTLE_PERIODS * 1e9 / pwmFrequency)));
+			PowerSample samples[PROFILE_SETTLE_BATCH];
+			uint64_t lastTime = monotonicNs();
+			long int start = millis();
+			bool settled = false;
+			while (!_profileStop && !settled && millis() - start < step.timeout)
+			{
+				size_t count = adcRing[ADC_IREAL].copy(samples, PROFILE_SETTLE_BATCH);
+				for (size_t i = 0; i < count; i++)
 				{
-					DEBUG(INDI::Logger::DBG_DEBUG, "Cannot read data from power sensor");
-					PowerReadingsNP.s = IPS_ALERT;
+					if (samples[i].time <= lastTime)
+						continue;
+					settle.add(samples[i].time, samples[i].value);
+					lastTime = samples[i].time;
 				}
+				settled = settle.settled(step.value);
+				std::this_thread::sleep_for(std::chrono::milliseconds(POLL_PERIOD / 10));
 			}
-			else
+			if (settled)
+			{
+				DEBUGF(INDI::Logger::DBG_SESSION, "Power profile: current settled at %0.2f A after %ld ms", settle.current(), millis() - start);
+			}
+			else if (!_profileStop)
 			{
-				DEBUG(INDI::Logger::DBG_DEBUG, "Cannot write data to power sensor");
-				PowerReadingsNP.s = IPS_ALERT;
+				DEBUGF(INDI::Logger::DBG_WARNING, "Power profile: current not settled within %ld ms, continuing", step.timeout);
 			}
 		}
-		powerIndex++;
-		if (powerIndex > 5)
-			powerIndex = 0;
+	}
 
-		lgI2cClose(i2cHandle);
-		IDSetNumber(&PowerReadingsNP, nullptr);
-		return true;
+	// outputs the profile did not reach get their requested state
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		int held = profileHold.exchange(0);
+		for (int load = LOAD_PWM1; load <= LOAD_OUT2; load++)
+		{
+			if (held & (1 << load))
+				applyOutput(load);
+		}
 	}
-	else
+	DEBUGF(INDI::Logger::DBG_SESSION, "Power profile %s %s", PowerProfilesT[profile].label, _profileStop ? "aborted" : "finished");
+	profileOutputsChanged = true;
+	profileFinished = true;
+}
+
+void AstroLink4Pi::profileUpdate()
+{
+	// output properties follow the states set by the profile thread
+	if (profileOutputsChanged.exchange(false))
 	{
-		DEBUG(INDI::Logger::DBG_DEBUG, "No power sensor found.");
-		return false;
+		std::lock_guard<std::mutex> lock(outputMutex);
+		IUResetSwitch(&Switch1SP);
+		Switch1S[relayState[0] ? S1_ON : S1_OFF].s = ISS_ON;
+		Switch1SP.s = relayState[0] ? IPS_OK : IPS_IDLE;
+		IDSetSwitch(&Switch1SP, nullptr);
+		IUResetSwitch(&Switch2SP);
+		Switch2S[relayState[1] ? S2_ON : S2_OFF].s = ISS_ON;
+		Switch2SP.s = relayState[1] ? IPS_OK : IPS_IDLE;
+		IDSetSwitch(&Switch2SP, nullptr);
+		PWM1N[0].value = pwmState[0];
+		IDSetNumber(&PWM1NP, nullptr);
+		PWM2N[0].value = pwmState[1];
+		IDSetNumber(&PWM2NP, nullptr);
+	}
+
+	if (profileFinished.exchange(false))
+	{
+		if (_profileThread.joinable())
+			_profileThread.join();
+		IUResetSwitch(&PowerProfileSP);
+		PowerProfileSP.s = IPS_OK;
+		IDSetSwitch(&PowerProfileSP, nullptr);
+	}
+}
+
+void AstroLink4Pi::stopPowerThread()
+{
+	if (_powerThread.joinable())
+	{
+		_powerStop = true;
+		_powerThread.join();
+	}
+}
+
+void AstroLink4Pi::initI2cDevices()
+{
+	const char *names[I2C_COUNT] = {"SHT", "MLX", "TSL", "SQM", "ADC"};
+	const int addresses[I2C_COUNT] = {SHT_ADDR, MLX_ADDR, TSL2591_ADDR, OLDSQM_ADDR, ADS1115_ADDR};
+	for (int device = 0; device < I2C_COUNT; device++)
+	{
+		i2cDevices[device].name = names[device];
+		i2cDevices[device].address = addresses[device];
+		i2cDevices[device].handle = lgI2cOpen(1, addresses[device], 0);
+		i2cDevices[device].consecutiveErrors = 0;
+		i2cDevices[device].answered = false;
+		i2cDevices[device].reopened = false;
+		i2cDevices[device].failedOpens = 0;
+		i2cDevices[device].retryAt = 0;
+	}
+}
+
+void AstroLink4Pi::closeI2cDevices()
+{
+	for (I2cDevice &device : i2cDevices)
+	{
+		if (device.handle >= 0)
+			lgI2cClose(device.handle);
+		device.handle = -1;
+	}
+}
+
+int AstroLink4Pi::getI2cHandle(int device)
+{
+	// opening always succeeds as Linux does not probe the address, absent devices are retried with backoff
+	I2cDevice &dev = i2cDevices[device];
+	if (dev.handle < 0 && monotonicNs() >= dev.retryAt)
+	{
+		dev.handle = lgI2cOpen(1, dev.address, 0);
+		dev.answered = false;
+		dev.reopened = true;
+	}
+	return dev.handle;
+}
+
+int AstroLink4Pi::i2cResult(int device, int result)
+{
+	I2cDevice &dev = i2cDevices[device];
+	dev.transactions++;
+	if (result >= 0)
+	{
+		dev.consecutiveErrors = 0;
+		// a reopen counts once the new handle answers
+		if (dev.reopened)
+			dev.reopens++;
+		dev.reopened = false;
+		dev.answered = true;
+		dev.failedOpens = 0;
+		return result;
+	}
+
+	dev.errors++;
+	// keep the handle over a single NACK, reopen when the device keeps failing
+	if (++dev.consecutiveErrors >= I2C_REOPEN_ERRORS && dev.handle >= 0)
+	{
+		lgI2cClose(dev.handle);
+		dev.handle = -1;
+		dev.consecutiveErrors = 0;
+		uint64_t now = monotonicNs();
+		if (dev.answered)
+		{
+			dev.retryAt = now;
+		}
+		else
+		{
+			long wait = std::min((long)I2C_RETRY_MIN << std::min(dev.failedOpens, 6), (long)I2C_RETRY_MAX);
+			dev.failedOpens++;
+			dev.retryAt = now + wait * 1000000ULL;
+			DEBUGF(INDI::Logger::DBG_DEBUG, "I2C %s (0x%02x) not answering, next attempt in %ld ms", dev.name, dev.address, wait);
+		}
+	}
+	return result;
+}
+
+void AstroLink4Pi::i2cStatsUpdate()
+{
+	char stats[64];
+	for (int device = 0; device < I2C_COUNT; device++)
+	{
+		snprintf(stats, sizeof(stats), "%ld tx / %ld err / %ld reopen", i2cDevices[device].transactions.load(), i2cDevices[device].errors.load(), i2cDevices[device].reopens.load());
+		IUSaveText(&I2cStatsT[device], stats);
 	}
+	I2cStatsTP.s = IPS_OK;
+	IDSetText(&I2cStatsTP, nullptr);
 }
 
 int AstroLink4Pi::checkRevision()
@@ -33,7 +33,26 @@
 #include <thread>
 #include <chrono>
 #include <string>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include "config.h"
+#include "stepper_motion.h"
+#include "sensor_snapshot.h"
+#include "tsl_autorange.h"
+#include "sqm_estimator.h"
+#include "battery_model.h"
+#include "power_stats.h"
+#include "load_disaggregation.h"
+#include "power_capture.h"
+#include "dew_controller.h"
+#include "fan_controller.h"
+#include "system_metrics.h"
+#include "pwm_interleave.h"
+#include "power_budget.h"
+#include "power_profile.h"
 
 #include <lgpio.h>
 
@@ -80,12 +99,14 @@ private:
 	virtual bool Disconnect();
 	virtual void SetResolution(int res);
 	virtual int savePosition(int pos);
-	virtual bool readSHT();
-	virtual bool readMLX();
-	virtual bool readSQM(bool triggerOldSensor);
-	virtual bool readTSL();
-	virtual bool readOLD();
-	virtual bool readPower();
+	virtual bool readSHT(SensorSnapshot &sample);
+	virtual bool readMLX(SensorSnapshot &sample);
+	virtual bool readTSL(SensorSnapshot &sample);
+	virtual bool readOLD(SensorSnapshot &sample);
+	long int tslPollPeriod();
+	void stopSHT();
+	static uint8_t shtCrc(const uint8_t *data);
+	virtual bool readPower(SensorSnapshot &sample);
 
 	ISwitch FocusResolutionS[6];
 	ISwitchVectorProperty FocusResolutionSP;
@@ -109,6 +130,29 @@ private:
 		HOLD_80,
 		HOLD_100
 	};
+	INumber HoldDecayN[2];
+	INumberVectorProperty HoldDecayNP;
+	enum
+	{
+		HOLD_DECAY_TIME,
+		HOLD_DECAY_LEVEL
+	};
+	INumber MotorThermalN[4];
+	INumberVectorProperty MotorThermalNP;
+	enum
+	{
+		THERMAL_R_COIL,
+		THERMAL_R_TH,
+		THERMAL_TAU,
+		THERMAL_MAX_RISE
+	};
+	INumber MotorTemperatureN[2];
+	INumberVectorProperty MotorTemperatureNP;
+	enum
+	{
+		MOTOR_CURRENT,
+		MOTOR_TEMP_RISE
+	};
 	INumber FocusStepDelayN[1];
 	INumberVectorProperty FocusStepDelayNP;
 	INumber FocusTemperatureN[1];
@@ -118,8 +162,111 @@ private:
 	ISwitch TemperatureCompensateS[2];
 	ISwitchVectorProperty TemperatureCompensateSP;
 	
+	ISwitch ShtRateS[5];
+	ISwitchVectorProperty ShtRateSP;
+	enum
+	{
+		SHT_RATE_05,
+		SHT_RATE_1,
+		SHT_RATE_2,
+		SHT_RATE_4,
+		SHT_RATE_10,
+		SHT_RATE_COUNT
+	};
+
     INumber SQMOffsetN[1];
     INumberVectorProperty SQMOffsetNP;	
+
+	INumber SqmSmoothingN[1];
+	INumberVectorProperty SqmSmoothingNP;
+
+	INumber SqmStatsN[2];
+	INumberVectorProperty SqmStatsNP;
+
+	ISwitch AdcRateS[ADC_RATE_COUNT];
+	ISwitchVectorProperty AdcRateSP;
+
+	INumber AdcWeightsN[ADC_CHANNEL_COUNT];
+	INumberVectorProperty AdcWeightsNP;
+
+	INumber EnergyCountersN[2];
+	INumberVectorProperty EnergyCountersNP;
+
+	ISwitch EnergyResetS[2];
+	ISwitchVectorProperty EnergyResetSP;
+
+	ISwitch BatteryTypeS[BATTERY_TYPE_COUNT];
+	ISwitchVectorProperty BatteryTypeSP;
+
+	INumber BatterySettingsN[3];
+	INumberVectorProperty BatterySettingsNP;
+
+	INumber BatteryStatusN[5];
+	INumberVectorProperty BatteryStatusNP;
+
+	ISwitch BrownoutS[2];
+	ISwitchVectorProperty BrownoutSP;
+
+	INumber BrownoutSettingsN[4];
+	INumberVectorProperty BrownoutSettingsNP;
+
+	INumber ShedOrderN[5];
+	INumberVectorProperty ShedOrderNP;
+
+	INumber LoadModelsN[5];
+	INumberVectorProperty LoadModelsNP;
+
+	INumber LoadEnergyN[6];
+	INumberVectorProperty LoadEnergyNP;
+
+	INumber BrownoutStatusN[4];
+	INumberVectorProperty BrownoutStatusNP;
+	enum
+	{
+		BROWNOUT_SHED,
+		BROWNOUT_LAST_LATENCY,
+		BROWNOUT_MAX_LATENCY,
+		BROWNOUT_BOUND
+	};
+
+	INumber AdcOversampleN[1];
+	INumberVectorProperty AdcOversampleNP;
+
+	ISwitch AdcFilterS[2];
+	ISwitchVectorProperty AdcFilterSP;
+
+	INumber AdcGainN[ADC_CHANNEL_COUNT];
+	INumberVectorProperty AdcGainNP;
+
+	INumber AdcOffsetN[ADC_CHANNEL_COUNT];
+	INumberVectorProperty AdcOffsetNP;
+
+	ISwitch AdcZeroS[1];
+	ISwitchVectorProperty AdcZeroSP;
+
+	INumber AdcChannelsN[ADC_CHANNEL_COUNT + 1];
+	INumberVectorProperty AdcChannelsNP;
+
+	INumber PowerStatsN[STATS_WINDOW_COUNT][STATS_CHANNEL_COUNT * STATS_VALUE_COUNT];
+	INumberVectorProperty PowerStatsNP[STATS_WINDOW_COUNT];
+
+	ISwitch PowerStatsResetS[1];
+	ISwitchVectorProperty PowerStatsResetSP;
+
+	INumber CaptureSettingsN[3];
+	INumberVectorProperty CaptureSettingsNP;
+
+	ISwitch CaptureChannelS[ADC_CHANNEL_COUNT];
+	ISwitchVectorProperty CaptureChannelSP;
+
+	ISwitch CaptureTriggerS[CAPTURE_TRIGGER_COUNT];
+	ISwitchVectorProperty CaptureTriggerSP;
+
+	ISwitch CaptureS[2];
+	ISwitchVectorProperty CaptureSP;
+
+	IBLOB CaptureB[1];
+	IBLOBVectorProperty CaptureBP;
     enum
     {
 		TSL_NOTAVAILABLE,
@@ -138,8 +285,33 @@ private:
 	INumber FocuserTravelN[1];
 	INumberVectorProperty FocuserTravelNP;
 
-	INumber FanPowerN[1];
+	ISwitch CfzPolicyS[2];
+	ISwitchVectorProperty CfzPolicySP;
+	enum
+	{
+		CFZ_POLICY_ON,
+		CFZ_POLICY_OFF
+	};
+	INumber CfzFractionN[1];
+	INumberVectorProperty CfzFractionNP;
+
+	INumber HomeSwitchN[5];
+	INumberVectorProperty HomeSwitchNP;
+	enum
+	{
+		HOME_GPIO,
+		HOME_POSITION,
+		HOME_BACKOFF,
+		HOME_FAST_DELAY,
+		HOME_SLOW_DELAY
+	};
+	ISwitch FocusHomeS[1];
+	ISwitchVectorProperty FocusHomeSP;
+
+	INumber FanPowerN[2];
 	INumberVectorProperty FanPowerNP;
+	INumber FanSettingsN[7];
+	INumberVectorProperty FanSettingsNP;
 
 	INumber PowerReadingsN[6];
 	INumberVectorProperty PowerReadingsNP;
@@ -181,6 +353,9 @@ private:
 		SYSI_PUBIP
 	};
 
+	IText I2cStatsT[5];
+	ITextVectorProperty I2cStatsTP;
+
 	IText RelayLabelsT[4];
 	ITextVectorProperty RelayLabelsTP;
 	enum
@@ -211,12 +386,54 @@ private:
 	INumber PWM2N[1];
 	INumberVectorProperty PWM2NP;
 
+	ISwitch DewControlS[2][2];
+	ISwitchVectorProperty DewControlSP[2];
+
+	INumber DewSettingsN[2][6];
+	INumberVectorProperty DewSettingsNP[2];
+
+	INumber DewStatusN[6];
+	INumberVectorProperty DewStatusNP;
+
+	ISwitch PwmPhaseS[2];
+	ISwitchVectorProperty PwmPhaseSP;
+
+	INumber PwmPeakN[5];
+	INumberVectorProperty PwmPeakNP;
+
+	ISwitch BudgetS[2];
+	ISwitchVectorProperty BudgetSP;
+
+	INumber BudgetSettingsN[4];
+	INumberVectorProperty BudgetSettingsNP;
+
+	INumber BudgetStatusN[3];
+	INumberVectorProperty BudgetStatusNP;
+
+	INumber PwmRampN[2];
+	INumberVectorProperty PwmRampNP;
+
+	IText PowerProfilesT[3] = {};
+	ITextVectorProperty PowerProfilesTP;
+
+	ISwitch PowerProfileS[4];
+	ISwitchVectorProperty PowerProfileSP;
+
 	INumber PWMcycleN[1];
 	INumberVectorProperty PWMcycleNP;
 
 	INumber StepperCurrentN[1];
 	INumberVectorProperty StepperCurrentNP;
 
+	INumber CurrentProfileN[3];
+	INumberVectorProperty CurrentProfileNP;
+	enum
+	{
+		PROFILE_BOOST,
+		PROFILE_CRUISE,
+		PROFILE_RAMP
+	};
+
 	int revision = 1;
 	int gpioType = 0;
 	int gpioChip = -1;
@@ -225,49 +442,363 @@ private:
 	int resolution = 1;
 
 	float lastTemperature;
-	float focuserTemperature;
-	bool SHTavailable = false;
-	bool MLXavailable = false;
-	bool SQMavailable = false;
 	int TSLmode = TSL_NOTAVAILABLE;
+	std::atomic<int> shtRate{SHT_RATE_1};
+	int shtRunningRate = -1;
+	int shtFetchFailures = 0;
 
 	int backlashTicksRemaining;
+	long cfzPendingTarget = -1;
+	bool cfzDeferred = false; // a deferred move is reported idle at the unchanged position on the next tick
 	int lastDirection = 0;
 
-	int pwmState[2];
-	int relayState[2];
+	// requested output states, load shedding may hold the hardware off
+	double pwmState[2] = {0, 0};
+	int relayState[2] = {0, 0};
+	std::atomic<double> pwmFrequency{20};
+	std::mutex outputMutex;
+	int setPwmOutput(int output, double duty);
+	int setRelayOutput(int output, int state);
+	int applyOutput(int load);
+
+	// heater and fan PWM phases, interleaved so their on-times overlap as little as possible
+	enum
+	{
+		PWM_ALIGNED,
+		PWM_INTERLEAVED
+	};
+	enum
+	{
+		PWM_PEAK_ALIGNED,
+		PWM_PEAK_INTERLEAVED,
+		PWM_OVERLAP,
+		PWM_CAPTURE_ALIGNED,
+		PWM_CAPTURE_INTERLEAVED
+	};
+	std::atomic<bool> pwmInterleaved{false};
+	std::atomic<long> pwmPhaseSince{0};
+	double pwmOverlapFraction = 0;
+	double fanDuty = -1; // < 0 until the fan pin is claimed
+	struct PwmIssue
+	{
+		double duty = -1; // < 0 forces the next request
+		int offset = 0;
+		double frequency = 0;
+	};
+	PwmIssue pwmIssued[3]; // last lgTxPwm request of PWM1, PWM2 and the fan
+	int setFanOutput(double duty);
+	int applyPwmOutputs();
+	double pwmDuty(int output);
+
+	// soft start, the applied duty slews towards pwmState on the ramp thread
+	double pwmRamped[2] = {0, 0};
+	std::atomic<double> pwmRampRate[2] = {{0}, {0}}; // % per second, 0 jumps
+	std::thread _rampThread;
+	std::atomic<bool> _rampStop{false};
+	std::atomic<bool> rampActive{false};
+	std::condition_variable rampCv;
+	void rampLoop();
+	void stopRampThread();
+
+	// heater duty limits keeping the total current within the budget
+	PowerBudget powerBudget;
+	double pwmLimit[2] = {100, 100};
+	long int lastBudgetUpdate = 0;
+	uint64_t budgetChanged = 0; // averaging restarts when a limit changes
+	void configureBudget();
+	double sampleMean(int channel, uint64_t sinceNs, double &mean);
+	void budgetUpdate(const SensorSnapshot &sample);
+
+	// staged output sequences run on their own thread, PROFILE_ outputs match the load order
+	enum
+	{
+		PROFILE_STARTUP,
+		PROFILE_SHUTDOWN,
+		PROFILE_CUSTOM,
+		PROFILE_COUNT
+	};
+	std::thread _profileThread;
+	std::atomic<bool> _profileStop{false};
+	std::atomic<int> profileHold{0}; // outputs kept off until the startup profile sets them
+	std::atomic<bool> profileOutputsChanged{false};
+	std::atomic<bool> profileFinished{false};
+	bool startProfile(int profile);
+	void stopProfileThread();
+	void profileLoop(std::vector<ProfileStep> steps, int profile);
+	void profileUpdate();
 
 	long int nextTemperatureRead = 0;
 	long int nextTemperatureCompensation = 0;
 	long int nextSystemRead = 0;
 	long int nextFanUpdate = 0;
+	long int nextHoldUpdate = 0;
+	long int lastHoldUpdate = 0;
+	std::atomic<long int> holdStartTime{0};
 	long int adcStartTime = 0;
-	int niter = 0;
-	int fullCumulative = 0;
-	int irCumulative = 0;
+	TslAutoRange tslRange;
+	SqmEstimator sqmEstimator;
+	std::atomic<double> sqmTimeConstant{10};
+	std::atomic<double> sqmOffset{0}; // calibration read by the acquisition thread
+
+	// ADS1115 scan sequencer, runs on its own thread
+	std::thread _powerThread;
+	std::atomic<bool> _powerStop{false};
+	std::atomic<bool> powerScanChanged{true};
+	std::atomic<bool> powerScanOk{false};
+	std::atomic<int> adcRate{5};
+	std::atomic<int> adcWeights[ADC_CHANNEL_COUNT] = {{2}, {1}, {0}, {0}, {2}};
+	std::atomic<double> adcScanRate{0};
+	std::atomic<int> adcOversample{1};
+	std::atomic<int> adcFilterMode{ADC_FILTER_MEAN};
+	std::atomic<double> adcGain[ADC_CHANNEL_COUNT] = {{6.6}, {6.6}, {1}, {1}, {1}};
+	std::atomic<double> adcOffset[ADC_CHANNEL_COUNT] = {{0}, {0}, {0}, {0}, {0}};
+	std::atomic<bool> zeroRequest{false};
+	std::atomic<bool> zeroDone{false};
+	std::atomic<double> zeroOffset{0};
+	std::atomic<double> energyAs{0};
+	std::atomic<double> energyWs{0};
+	std::atomic<double> lifetimeAs{0};
+	std::atomic<double> lifetimeWs{0};
+	std::atomic<double> chargeAs{0};
+	BatteryModel battery;
+
+	// brownout and overcurrent supervision, checked on every power sample
+	enum
+	{
+		LOAD_PWM1,
+		LOAD_PWM2,
+		LOAD_OUT1,
+		LOAD_OUT2,
+		LOAD_MOTOR,
+		LOAD_COUNT,
+		ALL_LOADS = (1 << LOAD_COUNT) - 1
+	};
+	struct BrownoutState
+	{
+		double vin = 1e9;
+		double itot = 0;
+		uint64_t lastVin = 0;
+		double vinInterval = 0; // ms, longest gap between input voltage samples in this window
+		double previousInterval = 0;
+		uint64_t windowStart = 0;
+		int violations = 0;
+		uint64_t firstViolation = 0;
+		uint64_t lastShed = 0;
+		uint64_t healthySince = 0;
+		uint64_t lastRestore = 0;
+	};
+	struct ShedEvent
+	{
+		int load;
+		bool shed;
+		uint64_t time;
+		double vin;
+		double itot;
+		double latency; // ms
+	};
+	BrownoutState brownout;
+	std::atomic<int> shedMask{0};
+	std::atomic<double> vinIntervalMax{0};
+	std::atomic<double> captureVinGap{0}; // ms, longest input voltage sample gap of the running capture
+	std::atomic<bool> brownoutEnabled{false};
+	std::atomic<double> brownoutVinMin{10.8};
+	std::atomic<double> brownoutItotMax{15};
+	std::atomic<double> brownoutHysteresis{0.5};
+	std::atomic<double> brownoutRestoreDelay{10};
+	std::atomic<int> shedPriority[LOAD_COUNT] = {{1}, {2}, {3}, {4}, {5}};
+	std::mutex shedEventMutex;
+	std::vector<ShedEvent> shedEvents;
+	std::atomic<bool> motorHoldShed{false};
+	bool motorShedPending = false; // shed while stepping, the motion thread disables the driver and logs it
+	ShedEvent motorShedEvent;
+
+	// per load current learned from the total current steps when outputs switch
+	LoadDisaggregator loadModel{LOAD_COUNT};
+	std::mutex loadMutex;
+	long int nextLoadUpdate = 0;
+	void loadLevelChanged(int load, double level);
+	void loadEnergyUpdate();
+
+	// dew heaters driven from the modelled optic temperature
+	enum
+	{
+		DEW_MANUAL,
+		DEW_AUTO
+	};
+	enum
+	{
+		DEW_MARGIN,
+		DEW_GAIN,
+		DEW_TAU,
+		DEW_KP,
+		DEW_KI,
+		DEW_SKY_COUPLING
+	};
+	DewController dewControl[2];
+	long int lastDewUpdate = 0;
+	void configureDewHeater(int channel);
+	void dewUpdate(long int timeMillis);
 
-	int powerIndex = 0;
-	float energyAs = 0.0;
-	float energyWs = 0.0;
+	// CPU fan driven from the thermal zone of the system metrics
+	enum
+	{
+		FAN_TARGET,
+		FAN_HYSTERESIS,
+		FAN_MIN_DUTY,
+		FAN_KP,
+		FAN_KI,
+		FAN_KD,
+		FAN_RATE
+	};
+	FanController fanControl;
+	SystemMetrics systemMetrics;
+	bool fanAvailable = false;
+	long int lastFanUpdate = 0;
+	void configureFan();
+	double readCpuTemperature();
+	void configureBrownout();
+	void brownoutCheck(int channel, const PowerSample &sample);
+	int nextShedLoad(bool shed);
+	void shedLoad(int load, uint64_t detected);
+	void restoreLoads(int mask, uint64_t detected);
+	void pushShedEvent(int load, bool shed, uint64_t detected, uint64_t done);
+	void queueShedEvent(ShedEvent event, uint64_t done);
+	void brownoutUpdate();
+	void configureBattery();
+	enum
+	{
+		ENERGY_RESET_SESSION = 1,
+		ENERGY_RESET_LIFETIME = 2
+	};
+	std::atomic<int> energyReset{0};
+	double lastEnergySaved = -1;
+	long int nextEnergyCheckpoint = 0;
+	void energyFileName(char *fileName);
+	bool loadEnergy();
+	bool saveEnergy();
+	SampleRing<ADC_RING_SIZE> adcRing[ADC_CHANNEL_COUNT];
+	PowerStatistics powerStats; // owned by the power thread
+	SnapshotBuffer<PowerStatsSnapshot> powerStatsSnapshot;
+	std::atomic<bool> powerStatsReset{false};
+	void publishPowerStats();
+
+	// on demand single channel capture run by the power thread at the fastest ADC rate
+	enum
+	{
+		CAPTURE_DURATION,
+		CAPTURE_PRETRIGGER,
+		CAPTURE_LEVEL
+	};
+	PowerCapture capture; // guarded by captureMutex
+	std::mutex captureMutex;
+	std::atomic<bool> captureActive{false};
+	std::atomic<bool> captureDone{false};
+	std::atomic<uint64_t> captureEvent{0};
+	std::vector<uint8_t> captureBlob;
+	long capturePhaseSince = 0; // heater PWM settings the capture was armed with
+	void captureUpdate();
+	uint64_t powerSamplesSeen = 0;
+	void powerLoop();
+	bool adcConvert(int i2cHandle, int channel, int rateIndex, bool continuous, int &continuousChannel, int16_t &raw);
+	void stopPowerThread();
+
+	// I2C devices opened once at connect and reused by the acquisition thread
+	enum
+	{
+		I2C_SHT,
+		I2C_MLX,
+		I2C_TSL,
+		I2C_OLDSQM,
+		I2C_ADC,
+		I2C_COUNT
+	};
+	struct I2cDevice
+	{
+		const char *name = nullptr;
+		int address = 0;
+		int handle = -1;
+		int consecutiveErrors = 0;
+		bool answered = false; // a transaction succeeded on the current handle
+		bool reopened = false; // handle reopened after errors, counted once it answers
+		int failedOpens = 0;   // handles in a row closed without a single successful transaction
+		uint64_t retryAt = 0;  // monotonic ns before which no new handle is opened
+		std::atomic<long> transactions{0};
+		std::atomic<long> errors{0};
+		std::atomic<long> reopens{0};
+	};
+	I2cDevice i2cDevices[I2C_COUNT];
+	long int nextI2cStats = 0;
+	void initI2cDevices();
+	void closeI2cDevices();
+	int getI2cHandle(int device);
+	int i2cResult(int device, int result);
+	void i2cStatsUpdate();
+
+	// sensor acquisition thread
+	enum
+	{
+		SENSOR_SHT,
+		SENSOR_MLX,
+		SENSOR_TSL,
+		SENSOR_OLDSQM,
+		SENSOR_POWER,
+		SENSOR_COUNT
+	};
+	std::thread _sensorThread;
+	std::atomic<bool> _sensorStop{false};
+	SnapshotBuffer<SensorSnapshot> sensorSnapshot;
+	SensorSnapshot lastSample;
+	void sensorLoop();
+	void stopSensorThread();
+	void publishSensors(const SensorSnapshot &sample);
 
 	std::thread _motionThread;
 	volatile bool _abort;
 
+	std::mutex motorMutex;					 // stepper driver outputs, motorStepping and the shed hold
+	std::atomic<double> motorCurrent{0};
+	std::atomic<double> motorHoldCurrent{0}; // mA the driver is left at between moves
+	std::atomic<bool> motorActive{false};	 // a move or homing owns the driver until it applies the hold
+	bool motorStepping = false;				 // driver at move current, a shed hold waits for the steps to end
+	double motorTempRise = 0;
+	bool holdCapped = false;
+
+	int homeGpio = 0;
+	StepperMotion motion;
+	std::atomic<long> homeLatch{0};
+	std::atomic<bool> homeArmed{false};
+	std::atomic<bool> homeTriggered{false};
+
 	int getHoldPower();
 	void getFocuserInfo();
 	void temperatureCompensation();
 	void setCurrent(bool standby);
+	void applyMotorCurrent(double current);
+	void driveMotor(double current);
+	void driveHold();
+	void stopStepping();
+	void finishMove();
+	void holdUpdate(long int timeMillis);
 	void systemUpdate();
-	void fanUpdate();
+	void fanUpdate(long int timeMillis);
 	int getMotorPWM(int current);
 	int setDac(int chan, int value);
 	int checkRevision();
 	long int millis();
-	std::thread getMotorThread(uint32_t targetPos, int direction, int pigpioHandle, int backlashTicksRemaining);
+	IPState moveFocuser(uint32_t targetTicks);
+	std::thread getMotorThread(uint32_t targetPos, int direction, int backlashTicksRemaining);
+	std::thread getHomingThread();
+	void stepPulse(int direction);
+	bool claimHomeSwitch(int gpio);
+	void releaseHomeSwitch();
+	bool homeSeek(int direction, int stepDelay, long maxSteps);
+	static void homeAlert(int num_alerts, lgGpioAlert_p alerts, void *userdata);
 
 	static constexpr const char *ENVIRONMENT_TAB{"Environment"};
 	static constexpr const char *SYSTEM_TAB{"System"};
 	static constexpr const char *OUTPUTS_TAB{"Outputs"};
+	static constexpr const char *POWER_STATS_TAB{"Power statistics"};
+	static constexpr const char *CAPTURE_TAB{"Power capture"};
 };
 
 #endif
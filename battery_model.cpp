@@ -0,0 +1,103 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "battery_model.h"
+
+#include <math.h>
+#include <algorithm>
+
+// resting pack voltage at 0, 10, ... 100 % charge
+static const double ocvTable[BATTERY_TYPE_COUNT][11] = {
+	{0},
+	{10.0, 12.0, 12.8, 12.9, 13.0, 13.05, 13.1, 13.2, 13.3, 13.4, 13.6},
+	{10.5, 11.31, 11.58, 11.75, 11.9, 12.06, 12.2, 12.32, 12.42, 12.5, 12.7},
+	{9.0, 10.35, 10.65, 10.86, 11.04, 11.22, 11.4, 11.61, 11.85, 12.15, 12.6}};
+
+void BatteryModel::configure(int chemistry, double capacityAh, double resistance, double averageWindow)
+{
+	if (chemistry != this->chemistry)
+		initialized = false;
+	this->chemistry = chemistry;
+	this->capacityAh = std::max(capacityAh, 0.1);
+	this->resistance = resistance;
+	this->averageWindow = std::max(averageWindow, 1.0);
+}
+
+double BatteryModel::ocvSoc(int chemistry, double voltage)
+{
+	if (chemistry <= BATTERY_NONE || chemistry >= BATTERY_TYPE_COUNT)
+		return 0;
+
+	const double *table = ocvTable[chemistry];
+	if (voltage <= table[0])
+		return 0;
+	for (int i = 1; i < 11; i++)
+	{
+		if (voltage < table[i])
+			return 10.0 * (i - 1 + (voltage - table[i - 1]) / (table[i] - table[i - 1]));
+	}
+	return 100;
+}
+
+void BatteryModel::update(double voltage, double current, double chargeAs, uint64_t timeNs)
+{
+	if (chemistry == BATTERY_NONE)
+		return;
+
+	// resting voltage estimate with the load drop across the pack resistance removed
+	double restingVoltage = voltage + current * resistance;
+
+	if (!initialized)
+	{
+		stateOfCharge = ocvSoc(chemistry, restingVoltage);
+		averageLoad = current;
+		lastCharge = chargeAs;
+		lastTime = timeNs;
+		restTime = 0;
+		initialized = true;
+		return;
+	}
+
+	double dt = (timeNs > lastTime) ? (timeNs - lastTime) / 1e9 : 0;
+	lastTime = timeNs;
+
+	// Coulomb counting, As to % of capacity
+	stateOfCharge -= (chargeAs - lastCharge) / 36.0 / capacityAh;
+	lastCharge = chargeAs;
+
+	averageLoad += (current - averageLoad) * std::min(dt / averageWindow, 1.0);
+
+	// pull toward the resting voltage after a rest, weighted by how steep the curve is here
+	double restCurrent = std::max(BATTERY_REST_RATE * capacityAh, BATTERY_REST_FLOOR);
+	restTime = (fabs(current) < restCurrent) ? restTime + dt : 0;
+	if (restTime >= BATTERY_REST_TIME)
+	{
+		double ocv = ocvSoc(chemistry, restingVoltage);
+		double slope = (ocvSoc(chemistry, restingVoltage + 0.05) - ocvSoc(chemistry, restingVoltage - 0.05)) / 0.1;
+		double trust = (slope > 0) ? std::min(1.0 / (slope * BATTERY_OCV_SLOPE), 1.0) : 0;
+		stateOfCharge += (ocv - stateOfCharge) * trust * std::min(dt / BATTERY_OCV_TAU, 1.0);
+	}
+
+	stateOfCharge = std::min(std::max(stateOfCharge, 0.0), 100.0);
+}
+
+double BatteryModel::runtime(double current) const
+{
+	return (current > 0 && valid()) ? remainingAh() / current : 0;
+}
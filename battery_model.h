@@ -0,0 +1,76 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef BATTERY_MODEL_H
+#define BATTERY_MODEL_H
+
+#include <stdint.h>
+
+#define BATTERY_REST_RATE 0.005	  // C rate below which the pack is resting
+#define BATTERY_REST_FLOOR 0.05	  // A rest threshold at least, above the current measurement noise
+#define BATTERY_REST_TIME 1800	  // s of rest before the resting voltage is trusted
+#define BATTERY_OCV_TAU 600		  // s time constant pulling the charge count toward the resting voltage
+#define BATTERY_OCV_SLOPE 0.03	  // V per % of charge at which the resting voltage is fully trusted
+
+enum
+{
+	BATTERY_NONE,
+	BATTERY_LIFEPO4_4S,
+	BATTERY_LEAD_ACID,
+	BATTERY_LIION_3S,
+	BATTERY_TYPE_COUNT
+};
+
+// State of charge of the pack feeding the board: Coulomb counting corrected by the
+// resting voltage where the chemistry's voltage curve is steep enough to tell.
+class BatteryModel
+{
+public:
+	void configure(int chemistry, double capacityAh, double resistance, double averageWindow);
+	void reset() { initialized = false; }
+
+	// input voltage, load current (positive when discharging) and charge drawn so far in As, never reset
+	void update(double voltage, double current, double chargeAs, uint64_t timeNs);
+
+	bool valid() const { return initialized && chemistry != BATTERY_NONE; }
+	double soc() const { return stateOfCharge; }
+	double remainingAh() const { return stateOfCharge / 100.0 * capacityAh; }
+	double averageCurrent() const { return averageLoad; }
+
+	// hours left at the given load, 0 when idle or charging
+	double runtime(double current) const;
+
+	// state of charge in % from a resting voltage
+	static double ocvSoc(int chemistry, double voltage);
+
+private:
+	int chemistry = BATTERY_NONE;
+	double capacityAh = 100;
+	double resistance = 0.02;
+	double averageWindow = 600;
+
+	bool initialized = false;
+	double stateOfCharge = 0;
+	double averageLoad = 0;
+	double lastCharge = 0;
+	uint64_t lastTime = 0;
+	double restTime = 0;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "fake_lgpio.h"
+
+#include <time.h>
+
+static int captureGpio = -1;
+static std::vector<uint64_t> *captureEdges = nullptr;
+static uint64_t writeCost = 0;
+
+uint64_t fakeGpioNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void fakeGpioCapture(int gpio, std::vector<uint64_t> *edges)
+{
+	captureGpio = gpio;
+	captureEdges = edges;
+}
+
+void fakeGpioWriteCost(uint64_t nanoseconds)
+{
+	writeCost = nanoseconds;
+}
+
+int lgGpioWrite(int handle, int gpio, int level)
+{
+	(void)handle;
+	uint64_t now = fakeGpioNow();
+	if (captureEdges != nullptr && gpio == captureGpio && level == 1)
+	{
+		captureEdges->push_back(now);
+	}
+	while (writeCost > 0 && fakeGpioNow() - now < writeCost)
+		;
+	return LG_OKAY;
+}
+
+uint64_t lguTimestamp(void)
+{
+	return fakeGpioNow();
+}
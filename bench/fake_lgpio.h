@@ -0,0 +1,42 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef FAKE_LGPIO_H
+#define FAKE_LGPIO_H
+
+#include <stdint.h>
+#include <vector>
+
+// Fake lgpio layer for the benchmarks: lines are not touched, rising edges of one
+// line are recorded with CLOCK_MONOTONIC nanosecond timestamps instead. The lgpio
+// calls used by the step engine are declared here, so the benchmark builds without lgpio.
+
+#define LG_OKAY 0
+
+int lgGpioWrite(int handle, int gpio, int level);
+uint64_t lguTimestamp(void);
+
+uint64_t fakeGpioNow();
+
+// record rising edges of gpio into edges, nullptr stops the capture
+void fakeGpioCapture(int gpio, std::vector<uint64_t> *edges);
+
+// busy wait added to every write to emulate the cost of the real GPIO ioctl
+void fakeGpioWriteCost(uint64_t nanoseconds);
+
+#endif
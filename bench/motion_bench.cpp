@@ -0,0 +1,151 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+/*
+ Step engine benchmark. Runs scripted moves of the focuser step generator against
+ the fake lgpio layer and prints one JSON object per step delay / resolution pair:
+
+   al4pi_motion_bench [--delays 200,500,...] [--resolutions 1,2,...] [--full-steps N]
+                      [--max-steps N] [--ramp N] [--gpio-cost ns]
+
+ Each move covers the same travel of --full-steps full steps, so finer resolutions
+ make proportionally more steps (capped by --max-steps to keep runs short).
+*/
+
+#include "stepper_motion.h"
+#include "fake_lgpio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define BENCH_DIR_PIN 23
+#define BENCH_STP_PIN 24
+
+static std::vector<long> parseList(const char *text)
+{
+	std::vector<long> values;
+	std::string list(text);
+	size_t start = 0;
+	while (start < list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		values.push_back(atol(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+	return values;
+}
+
+static double percentile(std::vector<double> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	size_t index = std::min(sorted.size() - 1, (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5));
+	return sorted[index];
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<long> delays = {200, 500, 1000, 2000, 5000, 10000, 20000};
+	std::vector<long> resolutions = {1, 2, 4, 8, 16, 32};
+	long fullSteps = 50;
+	long maxSteps = 2000;
+	long ramp = 0;
+	long gpioCost = 0;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "--delays"))
+			delays = parseList(argv[i + 1]);
+		else if (!strcmp(argv[i], "--resolutions"))
+			resolutions = parseList(argv[i + 1]);
+		else if (!strcmp(argv[i], "--full-steps"))
+			fullSteps = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "--max-steps"))
+			maxSteps = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "--ramp"))
+			ramp = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "--gpio-cost"))
+			gpioCost = atol(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	fakeGpioWriteCost(gpioCost);
+	StepperMotion motion(BENCH_DIR_PIN, BENCH_STP_PIN);
+
+	for (long delay : delays)
+	{
+		for (long resolution : resolutions)
+		{
+			MotionProfile profile;
+			profile.stepDelay = delay;
+			profile.rampSteps = ramp;
+
+			long steps = std::min(fullSteps * resolution, maxSteps);
+			std::vector<uint64_t> edges;
+			edges.reserve(steps);
+			volatile bool abort = false;
+
+			fakeGpioCapture(BENCH_STP_PIN, &edges);
+			uint64_t start = fakeGpioNow();
+			motion.run(0, steps, 1, 0, profile, abort, nullptr, nullptr);
+			uint64_t end = fakeGpioNow();
+			fakeGpioCapture(-1, nullptr);
+
+			// expected interval between rising edges n-1 and n is the delay after step n-1 plus the pulse width
+			double expectedTotal = 0;
+			std::vector<double> jitter;
+			for (long n = 0; n < (long)edges.size(); n++)
+			{
+				double expected = StepperMotion::stepDelay(profile, n, steps) + 10;
+				expectedTotal += expected;
+				if (n > 0)
+				{
+					double actual = (edges[n] - edges[n - 1]) / 1000.0;
+					jitter.push_back(fabs(actual - (StepperMotion::stepDelay(profile, n - 1, steps) + 10)));
+				}
+			}
+			std::sort(jitter.begin(), jitter.end());
+
+			double actualTotal = (end - start) / 1000.0;
+			double achievedRate = (edges.size() > 1) ? (edges.size() - 1) * 1e9 / (double)(edges.back() - edges.front()) : 0;
+
+			printf("{\"delay_us\":%ld,\"resolution\":%ld,\"steps\":%zu,\"ramp_steps\":%ld,"
+				   "\"expected_rate_hz\":%.1f,\"achieved_rate_hz\":%.1f,"
+				   "\"jitter_p50_us\":%.1f,\"jitter_p90_us\":%.1f,\"jitter_p99_us\":%.1f,\"jitter_max_us\":%.1f,"
+				   "\"expected_time_ms\":%.3f,\"actual_time_ms\":%.3f,\"time_error_pct\":%.2f}\n",
+				   delay, resolution, edges.size(), ramp,
+				   1e6 / (delay + 10), achievedRate,
+				   percentile(jitter, 50), percentile(jitter, 90), percentile(jitter, 99), jitter.empty() ? 0 : jitter.back(),
+				   expectedTotal / 1000, actualTotal / 1000, 100 * (actualTotal - expectedTotal) / expectedTotal);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+
+/*
+ System info update benchmark. Runs the shell pipelines systemUpdate used before and the
+ native SystemMetrics readers for CPU temperature, uptime and load, and prints one JSON
+ object per implementation:
+
+   al4pi_metrics_bench [--updates N] [--native-updates N]
+
+ CPU time includes the children spawned by popen, so it is what the update costs the Pi.
+*/
+
+#include "system_metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static double monotonicSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// user and system time of this process and its waited for children
+static double cpuSeconds()
+{
+	double total = 0;
+	int who[2] = {RUSAGE_SELF, RUSAGE_CHILDREN};
+	for (int w : who)
+	{
+		struct rusage usage;
+		getrusage(w, &usage);
+		total += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+		total += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	}
+	return total;
+}
+
+static bool readPipe(const char *command, char *buffer, int size)
+{
+	FILE *pipe = popen(command, "r");
+	if (pipe == NULL)
+		return false;
+	bool ok = (fgets(buffer, size, pipe) != NULL);
+	pclose(pipe);
+	return ok;
+}
+
+// the three pipelines of the former systemUpdate
+static int updatePopen(char *temperature, char *uptime, char *load)
+{
+	int values = 0;
+	values += readPipe("echo $(($(cat /sys/class/thermal/thermal_zone0/temp)/1000))", temperature, 128);
+	values += readPipe("uptime|awk -F, '{print $1}'|awk -Fup '{print $2}'|xargs", uptime, 128);
+	values += readPipe("uptime|awk -F, '{print $3\" /\"$4\" /\"$5}'|awk -F: '{print $2}'|xargs", load, 128);
+	return values;
+}
+
+static int updateNative(const SystemMetrics &metrics, char *temperature, char *uptime, char *load)
+{
+	int values = 0;
+	double value;
+	double average[3];
+	if (metrics.cpuTemperature(value))
+	{
+		SystemMetrics::formatTemperature(value, temperature, 128);
+		values++;
+	}
+	if (metrics.uptime(value))
+	{
+		SystemMetrics::formatUptime(value, uptime, 128);
+		values++;
+	}
+	if (metrics.loadAverage(average))
+	{
+		SystemMetrics::formatLoad(average, load, 128);
+		values++;
+	}
+	return values;
+}
+
+static void report(const char *name, long updates, long values, double wall, double cpu,
+				   const char *temperature, const char *uptime, const char *load)
+{
+	// pipeline output keeps its trailing new line
+	char text[3][128];
+	const char *source[3] = {temperature, uptime, load};
+	for (int i = 0; i < 3; i++)
+	{
+		strncpy(text[i], source[i], sizeof(text[i]) - 1);
+		text[i][sizeof(text[i]) - 1] = 0;
+		text[i][strcspn(text[i], "\n\"")] = 0;
+	}
+	printf("{\"impl\":\"%s\",\"updates\":%ld,\"values\":%ld,\"wall_us_per_update\":%.1f,\"cpu_us_per_update\":%.1f,"
+		   "\"cpu_temp\":\"%s\",\"uptime\":\"%s\",\"load\":\"%s\"}\n",
+		   name, updates, values, wall / updates * 1e6, cpu / updates * 1e6, text[0], text[1], text[2]);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	long updates = 100;
+	long nativeUpdates = 100000;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "--updates"))
+			updates = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "--native-updates"))
+			nativeUpdates = atol(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (updates < 1 || nativeUpdates < 1)
+	{
+		fprintf(stderr, "Update counts must be positive\n");
+		return 1;
+	}
+
+	char temperature[128] = "", uptime[128] = "", load[128] = "";
+	long values = 0;
+	double wall = monotonicSeconds(), cpu = cpuSeconds();
+	for (long i = 0; i < updates; i++)
+		values += updatePopen(temperature, uptime, load);
+	report("popen", updates, values, monotonicSeconds() - wall, cpuSeconds() - cpu, temperature, uptime, load);
+
+	SystemMetrics metrics;
+	if (!metrics.open())
+		fprintf(stderr, "Some system metrics cannot be opened\n");
+	values = 0;
+	wall = monotonicSeconds();
+	cpu = cpuSeconds();
+	for (long i = 0; i < nativeUpdates; i++)
+		values += updateNative(metrics, temperature, uptime, load);
+	report("native", nativeUpdates, values, monotonicSeconds() - wall, cpuSeconds() - cpu, temperature, uptime, load);
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+/*
+ TSL2591 auto-ranging simulation. Feeds a simulated sensor at fixed sky brightness
+ levels to the fixed setting accumulation used before and to the auto-ranging engine,
+ and prints one JSON object per brightness level:
+
+   al4pi_tsl_sim [--sky 16,18,20,21,22] [--trials N] [--ir-ratio r] [--seed n]
+
+ Times are sensor time from power up to the first SQM reading. Both paths are
+ charged the integration time plus the same ADC margin per integration, so the
+ comparison shows what the engine changes and not how the former code polled.
+*/
+
+#include "tsl_autorange.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#define SIM_FILTER_COEFF -1.2  // same as FILTER_COEFF of the driver
+#define SIM_ADC_MARGIN 20	   // same as TSL2591_ADC_MARGIN of the driver
+#define SIM_MAX_INTEGRATIONS 1000
+
+static std::vector<double> parseList(const char *text)
+{
+	std::vector<double> values;
+	std::string list(text);
+	size_t start = 0;
+	while (start < list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		values.push_back(atof(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+	return values;
+}
+
+class SimSensor
+{
+public:
+	SimSensor(double mpsas, double irRatio, unsigned seed) : irRatio(irRatio), rng(seed)
+	{
+		// inverse of the driver formula, visible counts at max gain and 600 ms
+		visibleMax = 29628.0 * exp((12.6 + SIM_FILTER_COEFF - mpsas) / 1.086);
+	}
+
+	void integrate(int gainIndex, int timeIndex, int &full, int &ir)
+	{
+		double scale = TslAutoRange::gains[gainIndex] * (timeIndex + 1) * 100 / (TslAutoRange::gains[TSL_GAIN_COUNT - 1] * 600.0);
+		int visible = noisy(visibleMax * scale);
+		ir = std::min(noisy(visibleMax * irRatio * scale), TslAutoRange::fullScale(timeIndex));
+		full = std::min(visible + ir, TslAutoRange::fullScale(timeIndex));
+	}
+
+private:
+	int noisy(double mean)
+	{
+		if (mean > 1e6)
+			return (int)mean;
+		std::poisson_distribution<int> poisson(mean);
+		return poisson(rng);
+	}
+
+	double visibleMax;
+	double irRatio;
+	std::mt19937 rng;
+};
+
+static double toMpsas(double visible)
+{
+	return 12.6 - 1.086 * log(visible / 29628.0) + SIM_FILTER_COEFF;
+}
+
+// accumulation at max gain and 600 ms as done before auto-ranging
+static double runLegacy(SimSensor &sensor, int &integrations, bool &saturated)
+{
+	int niter = 0, fullCumulative = 0, irCumulative = 0;
+	integrations = 0;
+	saturated = false;
+	while (true)
+	{
+		int full, ir;
+		sensor.integrate(TSL_GAIN_COUNT - 1, 5, full, ir);
+		integrations++;
+		saturated |= (full >= TslAutoRange::fullScale(5));
+		int visCumulative = fullCumulative - irCumulative;
+		if (full < ir)
+			continue;
+		if (niter < 5 || (visCumulative < 500 && niter < 150))
+		{
+			niter++;
+			fullCumulative += full;
+			irCumulative += ir;
+		}
+		else
+		{
+			return toMpsas((double)visCumulative / niter);
+		}
+	}
+}
+
+static double runAutoRange(SimSensor &sensor, int &integrations, double &elapsed)
+{
+	TslAutoRange range;
+	integrations = 0;
+	elapsed = 0;
+	while (integrations < SIM_MAX_INTEGRATIONS)
+	{
+		int full, ir;
+		sensor.integrate(range.gain(), range.control() & 0x07, full, ir);
+		integrations++;
+		elapsed += range.integrationMs() + SIM_ADC_MARGIN;
+		if (range.addReading(full, ir) == TslAutoRange::TSL_READY)
+			return toMpsas(range.visible());
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<double> skies = {10, 13, 16, 18, 19, 20, 21, 21.5, 22};
+	long trials = 50;
+	double irRatio = 0.3;
+	unsigned seed = 1;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "--sky"))
+			skies = parseList(argv[i + 1]);
+		else if (!strcmp(argv[i], "--trials"))
+			trials = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "--ir-ratio"))
+			irRatio = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--seed"))
+			seed = atoi(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (double sky : skies)
+	{
+		SimSensor sensor(sky, irRatio, seed);
+		double legacyTime = 0, legacyError = 0, autoTime = 0, autoError = 0;
+		long legacyIntegrations = 0, autoIntegrations = 0, legacySaturated = 0;
+		for (long trial = 0; trial < trials; trial++)
+		{
+			int integrations;
+			bool saturated;
+			double mpsas = runLegacy(sensor, integrations, saturated);
+			legacyTime += integrations * (600 + SIM_ADC_MARGIN);
+			legacyIntegrations += integrations;
+			legacyError += fabs(mpsas - sky);
+			legacySaturated += saturated;
+
+			double elapsed;
+			mpsas = runAutoRange(sensor, integrations, elapsed);
+			autoTime += elapsed;
+			autoIntegrations += integrations;
+			autoError += fabs(mpsas - sky);
+		}
+
+		printf("{\"sky_mpsas\":%.2f,\"trials\":%ld,"
+			   "\"fixed_time_ms\":%.0f,\"fixed_integrations\":%.1f,\"fixed_error_mag\":%.3f,\"fixed_saturated_pct\":%.0f,"
+			   "\"auto_time_ms\":%.0f,\"auto_integrations\":%.1f,\"auto_error_mag\":%.3f,\"speedup\":%.1f}\n",
+			   sky, trials,
+			   legacyTime / trials, (double)legacyIntegrations / trials, legacyError / trials, 100.0 * legacySaturated / trials,
+			   autoTime / trials, (double)autoIntegrations / trials, autoError / trials, legacyTime / autoTime);
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "dew_controller.h"
+
+#include <math.h>
+#include <algorithm>
+
+void DewController::reset()
+{
+	initialised = false;
+	integral = 0;
+	lastDuty = 0;
+}
+
+double DewController::update(double ambient, double dewPoint, double sky, double applied, double dt)
+{
+	double unheated = ambient;
+	if (!isnan(sky) && settings.skyCoupling > 0)
+		unheated -= settings.skyCoupling * (ambient - sky);
+
+	// optic follows the equilibrium of the duty applied since the last update
+	if (!initialised)
+	{
+		optic = unheated;
+		initialised = true;
+	}
+	double equilibrium = unheated + settings.gain * applied / 100;
+	optic += (equilibrium - optic) * (1 - exp(-dt / std::max(settings.tau, 1.0)));
+
+	target = dewPoint + settings.margin;
+	double feedForward = (settings.gain > 0) ? (target - unheated) / settings.gain * 100 : 0;
+	double error = target - optic;
+	double output = feedForward + settings.kp * error + integral;
+
+	// integrate only while the output can still move in the direction of the error,
+	// a heater held below the last request cannot raise the optic any further
+	bool held = (applied < lastDuty - 1);
+	if ((output < 100 || error < 0) && (output > 0 || error > 0) && !(held && error > 0))
+	{
+		integral += settings.ki * error * dt / 60;
+		integral = std::min(std::max(integral, -100.0), 100.0);
+	}
+
+	lastDuty = std::min(std::max(feedForward + settings.kp * error + integral, 0.0), 100.0);
+	return lastDuty;
+}
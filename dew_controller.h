@@ -0,0 +1,60 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef DEW_CONTROLLER_H
+#define DEW_CONTROLLER_H
+
+struct DewHeaterSettings
+{
+	double margin = 3;		  // C above the dew point to hold the optic at
+	double gain = 8;		  // C the heater raises the optic by at 100% duty
+	double tau = 600;		  // s, optic thermal time constant
+	double kp = 10;			  // % per C of error
+	double ki = 2;			  // % per C of error and minute
+	double skyCoupling = 0.2; // fraction of the ambient - sky difference the optic loses by radiation
+};
+
+// Dew heater controller for an optic without a temperature sensor. The optic temperature is
+// modelled as a first order lag towards ambient less the radiative loss to the sky plus the
+// heater rise. Feed-forward sets the duty for the target at equilibrium, PI on the modelled
+// temperature corrects while the optic is still on its way there.
+class DewController
+{
+public:
+	void configure(const DewHeaterSettings &settings) { this->settings = settings; }
+	void reset();
+
+	// returns the new duty in %, sky is NAN when no sky temperature is used, applied is the
+	// duty the heater actually ran at since the last update (after shedding, budget and ramp)
+	double update(double ambient, double dewPoint, double sky, double applied, double dt);
+
+	double opticTemperature() const { return optic; }
+	double targetTemperature() const { return target; }
+	double duty() const { return lastDuty; }
+
+private:
+	DewHeaterSettings settings;
+	bool initialised = false;
+	double optic = 0;
+	double target = 0;
+	double integral = 0;
+	double lastDuty = 0;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "fan_controller.h"
+
+#include <math.h>
+#include <algorithm>
+
+void FanController::reset()
+{
+	initialised = false;
+	spinning = false;
+	integral = 0;
+	kickLeft = 0;
+	lastDuty = 0;
+}
+
+double FanController::update(double temperature, double dt)
+{
+	if (!initialised)
+	{
+		filtered = temperature;
+		initialised = true;
+		dt = 0;
+	}
+	double previous = filtered;
+	if (dt > 0)
+		filtered += (temperature - filtered) * std::min(dt / std::max(settings.filter, 1e-3), 1.0);
+	double rise = (dt > 0) ? (filtered - previous) / dt : 0;
+	double error = filtered - settings.target;
+
+	if (!spinning)
+	{
+		if (error < settings.hysteresis)
+		{
+			lastDuty = 0;
+			return lastDuty;
+		}
+		// start from the minimum spin, the integral takes it from there
+		spinning = true;
+		integral = settings.minDuty;
+		kickLeft = settings.kickTime;
+	}
+
+	double output = settings.kp * error + integral + settings.kd * rise;
+
+	// integrate only while the output can still move in the direction of the error
+	if ((output < 100 || error < 0) && (output > settings.minDuty || error > 0))
+	{
+		integral += settings.ki * error * dt / 60;
+		integral = std::min(std::max(integral, 0.0), 100.0);
+	}
+
+	double duty = settings.kp * error + integral + settings.kd * rise;
+	if (duty < settings.minDuty)
+	{
+		if (error <= -settings.hysteresis)
+		{
+			spinning = false;
+			integral = 0;
+			lastDuty = 0;
+			return lastDuty;
+		}
+		duty = settings.minDuty;
+	}
+	duty = std::min(duty, 100.0);
+
+	if (kickLeft > 0)
+	{
+		duty = std::max(duty, settings.kickDuty);
+		kickLeft -= std::max(dt, 1e-3);
+	}
+
+	lastDuty = duty;
+	return lastDuty;
+}
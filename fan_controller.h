@@ -0,0 +1,62 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef FAN_CONTROLLER_H
+#define FAN_CONTROLLER_H
+
+struct FanSettings
+{
+	double target = 55;		// C the CPU is held at
+	double hysteresis = 3;	// C above the target the fan starts, below it stops
+	double minDuty = 25;	// % below which the fan stalls
+	double kickDuty = 100;	// % applied when the fan starts so it spins up reliably
+	double kickTime = 1;	// s the kick duty is held
+	double kp = 6;			// % per C of error
+	double ki = 10;			// % per C of error and minute
+	double kd = 0;			// % per C/s of temperature rise
+	double filter = 4;		// s, time constant of the temperature smoothing
+};
+
+// CPU fan controller. PID on the smoothed temperature while running, the fan starts with a
+// short kick once the temperature is above the hysteresis band and stops only when it has
+// fallen below the band at minimum duty, so it does not hunt around the stall speed.
+class FanController
+{
+public:
+	void configure(const FanSettings &settings) { this->settings = settings; }
+	void reset();
+
+	// returns the new duty in %
+	double update(double temperature, double dt);
+
+	double temperature() const { return filtered; }
+	double duty() const { return lastDuty; }
+	bool running() const { return spinning; }
+
+private:
+	FanSettings settings;
+	bool initialised = false;
+	bool spinning = false;
+	double filtered = 0;
+	double integral = 0;
+	double kickLeft = 0;
+	double lastDuty = 0;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "load_disaggregation.h"
+
+#include <math.h>
+#include <algorithm>
+
+LoadDisaggregator::LoadDisaggregator(int loads) : loads(loads)
+{
+}
+
+double LoadDisaggregator::current(int load) const
+{
+	return std::max(loads[load].model, 0.0) * loads[load].level;
+}
+
+void LoadDisaggregator::resetEnergy()
+{
+	for (Load &load : loads)
+		load.energyWs = 0;
+	otherWs = 0;
+}
+
+bool LoadDisaggregator::averageBefore(uint64_t timeNs, double &average) const
+{
+	double sum = 0;
+	int count = 0;
+	for (const Sample &sample : history)
+	{
+		if (sample.time + LOAD_STEP_WINDOW_NS >= timeNs && sample.time <= timeNs)
+		{
+			sum += sample.current;
+			count++;
+		}
+	}
+	if (count < LOAD_STEP_MIN_SAMPLES)
+		return false;
+	average = sum / count;
+	return true;
+}
+
+bool LoadDisaggregator::setLevel(int load, double level, uint64_t timeNs)
+{
+	double change = level - loads[load].level;
+	loads[load].level = level;
+	if (change == 0)
+		return false;
+
+	// two loads switching within one window cannot be told apart
+	bool quiet = (lastEvent == 0 || timeNs - lastEvent >= LOAD_STEP_WINDOW_NS);
+	pending = false;
+	lastEvent = timeNs;
+	if (!quiet || fabs(change) < LOAD_STEP_MIN_LEVEL)
+		return true;
+
+	Step next;
+	next.load = load;
+	next.levelChange = change;
+	next.time = timeNs;
+	if (!averageBefore(timeNs, next.before))
+		return true;
+	step = next;
+	pending = true;
+	return true;
+}
+
+void LoadDisaggregator::finishStep()
+{
+	pending = false;
+	if (step.afterCount < LOAD_STEP_MIN_SAMPLES)
+		return;
+
+	double observed = (step.afterSum / step.afterCount - step.before) / step.levelChange;
+	Load &load = loads[step.load];
+	load.observations++;
+	load.model += (observed - load.model) / std::min(load.observations, LOAD_LEARN_MAX);
+}
+
+void LoadDisaggregator::addSample(double total, double vin, uint64_t timeNs)
+{
+	history.push_back({timeNs, total});
+	while (!history.empty() && history.front().time + LOAD_STEP_WINDOW_NS < timeNs)
+		history.pop_front();
+
+	if (pending && timeNs >= step.time + LOAD_STEP_SETTLE_NS)
+	{
+		if (timeNs <= step.time + LOAD_STEP_SETTLE_NS + LOAD_STEP_WINDOW_NS)
+		{
+			step.afterSum += total;
+			step.afterCount++;
+		}
+		else
+		{
+			finishStep();
+		}
+	}
+
+	// energy of every load from its model, whatever is left over is the base load
+	if (lastSample != 0 && timeNs > lastSample)
+	{
+		double dt = (timeNs - lastSample) / 1e9;
+		double attributed = 0;
+		for (size_t i = 0; i < loads.size(); i++)
+		{
+			double loadCurrent = std::min(current(i), std::max(total - attributed, 0.0));
+			loads[i].energyWs += loadCurrent * vin * dt;
+			attributed += loadCurrent;
+		}
+		otherWs += std::max(total - attributed, 0.0) * vin * dt;
+	}
+	lastSample = timeNs;
+}
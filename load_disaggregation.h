@@ -0,0 +1,87 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef LOAD_DISAGGREGATION_H
+#define LOAD_DISAGGREGATION_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#define LOAD_STEP_WINDOW_NS 500000000ULL  // current is averaged over this long on each side of a switching event
+#define LOAD_STEP_SETTLE_NS 150000000ULL  // inrush and regulator transients after the event are skipped
+#define LOAD_STEP_MIN_SAMPLES 3
+#define LOAD_STEP_MIN_LEVEL 0.1			  // smaller level changes hide in the current sensor noise
+#define LOAD_LEARN_MAX 10				  // model follows the last ~10 observations once learned
+
+// Splits the measured total current between loads from the current steps seen when they switch.
+// Every load has a level (0..1 duty or on/off, phase current in A for the motor) and learns its
+// current per unit of level; the rest of the total is kept as the unattributed base load.
+class LoadDisaggregator
+{
+public:
+	explicit LoadDisaggregator(int loads);
+
+	// returns true when the level actually changed
+	bool setLevel(int load, double level, uint64_t timeNs);
+	void addSample(double total, double vin, uint64_t timeNs);
+	void resetEnergy();
+
+	double model(int load) const { return loads[load].model; }
+	int observations(int load) const { return loads[load].observations; }
+	double current(int load) const;
+	double energyWs(int load) const { return loads[load].energyWs; }
+	double otherEnergyWs() const { return otherWs; }
+
+private:
+	struct Load
+	{
+		double level = 0;
+		double model = 0;
+		int observations = 0;
+		double energyWs = 0;
+	};
+	struct Step
+	{
+		int load;
+		double levelChange;
+		uint64_t time;
+		double before;
+		double afterSum = 0;
+		int afterCount = 0;
+	};
+	struct Sample
+	{
+		uint64_t time;
+		double current;
+	};
+
+	bool averageBefore(uint64_t timeNs, double &average) const;
+	void finishStep();
+
+	std::vector<Load> loads;
+	std::deque<Sample> history;
+	bool pending = false;
+	Step step;
+	uint64_t lastEvent = 0;
+	uint64_t lastSample = 0;
+	double otherWs = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "power_budget.h"
+
+#include <math.h>
+#include <algorithm>
+
+void PowerBudget::configure(double itotMax, double ptotMax, double hysteresis, double releaseRate)
+{
+	this->itotMax = itotMax;
+	this->ptotMax = ptotMax;
+	this->hysteresis = hysteresis;
+	this->releaseRate = releaseRate;
+}
+
+void PowerBudget::reset()
+{
+	for (double &limit : limits)
+		limit = 100;
+	lastHeadroom = 0;
+}
+
+double PowerBudget::budget(double vin) const
+{
+	double current = INFINITY;
+	if (itotMax > 0)
+		current = itotMax;
+	if (ptotMax > 0 && vin > 1)
+		current = std::min(current, ptotMax / vin);
+	return current;
+}
+
+bool PowerBudget::update(double itot, double vin, const double *requested, const double *model, const int *priority, double dt)
+{
+	double previous[BUDGET_OUTPUTS];
+	std::copy(limits, limits + BUDGET_OUTPUTS, previous);
+
+	// throttle order, lowest priority number first
+	int order[BUDGET_OUTPUTS];
+	int count = 0;
+	for (int output = 0; output < BUDGET_OUTPUTS; output++)
+	{
+		if (priority[output] > 0)
+			order[count++] = output;
+		else
+			limits[output] = 100;
+	}
+	std::sort(order, order + count, [priority](int a, int b) { return priority[a] < priority[b]; });
+
+	double allowed = budget(vin);
+	lastHeadroom = std::isinf(allowed) ? 0 : allowed - itot;
+	if (std::isinf(allowed))
+	{
+		reset();
+	}
+	else if (itot > allowed)
+	{
+		double excess = itot - allowed;
+		for (int i = 0; i < count && excess > 0; i++)
+		{
+			int output = order[i];
+			double duty = std::min(requested[output], limits[output]);
+			if (duty <= 0)
+				continue;
+			if (model[output] < BUDGET_MIN_MODEL)
+			{
+				// unknown heater current, cut one step and look at the result next time
+				limits[output] = std::max(duty - BUDGET_BLIND_STEP, 0.0);
+				break;
+			}
+			double cut = std::min(duty, excess / model[output] * 100);
+			limits[output] = duty - cut;
+			excess -= cut * model[output] / 100;
+		}
+	}
+	else if (itot < allowed - hysteresis)
+	{
+		// release one heater at a time, highest priority first
+		double spare = allowed - hysteresis - itot;
+		for (int i = count - 1; i >= 0; i--)
+		{
+			int output = order[i];
+			if (limits[output] >= 100)
+				continue;
+			double step = releaseRate * dt;
+			if (model[output] >= BUDGET_MIN_MODEL)
+				step = std::min(step, spare / model[output] * 100);
+			limits[output] += step;
+			if (limits[output] >= requested[output])
+				limits[output] = 100;
+			break;
+		}
+	}
+
+	bool changed = false;
+	for (int output = 0; output < BUDGET_OUTPUTS; output++)
+		changed |= (fabs(limits[output] - previous[output]) >= 0.5);
+	return changed;
+}
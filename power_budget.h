@@ -0,0 +1,54 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef POWER_BUDGET_H
+#define POWER_BUDGET_H
+
+#define BUDGET_OUTPUTS 2	  // only the PWM heaters are throttled
+#define BUDGET_BLIND_STEP 10  // % duty cut per update while a heater has no learned current
+#define BUDGET_MIN_MODEL 0.05 // A at 100% duty below which a heater current counts as unknown
+
+// Keeps the total current under a current and power budget by lowering the duty limit of
+// the heaters, lowest priority first, and raising it again in reverse order once there is headroom.
+// The budget limits the average current: itot must be a mean over whole PWM periods, peaks
+// within a PWM cycle are left to the brownout protection.
+class PowerBudget
+{
+public:
+	void configure(double itotMax, double ptotMax, double hysteresis, double releaseRate);
+	void reset();
+
+	// requested duty in %, model in A at 100% duty, priority 0 never throttles
+	// returns true when a limit changed
+	bool update(double itot, double vin, const double *requested, const double *model, const int *priority, double dt);
+
+	double limit(int output) const { return limits[output]; }
+	double headroom() const { return lastHeadroom; }
+	double budget(double vin) const;
+
+private:
+	double itotMax = 0;
+	double ptotMax = 0;
+	double hysteresis = 0.5;
+	double releaseRate = 5; // % duty per second
+	double limits[BUDGET_OUTPUTS] = {100, 100};
+	double lastHeadroom = 0;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "power_capture.h"
+
+#include <string.h>
+#include <algorithm>
+
+void PowerCapture::arm(int channel, int trigger, double level, size_t samples, size_t preSamples)
+{
+	samples = std::min(std::max(samples, (size_t)1), (size_t)CAPTURE_MAX_SAMPLES);
+	captureChannel = channel;
+	triggerMode = trigger;
+	triggerLevel = level;
+	// an immediate capture has nothing before its trigger
+	preLength = (trigger == CAPTURE_TRIGGER_IMMEDIATE) ? 0 : std::min(preSamples, samples - 1);
+	postLength = samples - preLength;
+	pre.clear();
+	pre.reserve(preLength);
+	preNext = 0;
+	post.clear();
+	post.reserve(postLength);
+	triggerTime = 0;
+	havePrevious = false;
+	captureState = CAPTURE_ARMED;
+}
+
+void PowerCapture::abort()
+{
+	captureState = CAPTURE_IDLE;
+}
+
+void PowerCapture::start(uint64_t timeNs)
+{
+	// unroll the pre-trigger ring into time order
+	std::rotate(pre.begin(), pre.begin() + (pre.size() < preLength ? 0 : preNext), pre.end());
+	triggerTime = timeNs;
+	captureState = CAPTURE_TRIGGERED;
+}
+
+void PowerCapture::trigger(uint64_t timeNs)
+{
+	if (captureState == CAPTURE_ARMED && triggerMode == CAPTURE_TRIGGER_OUTPUT)
+		start(timeNs);
+}
+
+bool PowerCapture::add(double value, uint64_t timeNs)
+{
+	if (captureState == CAPTURE_ARMED)
+	{
+		bool fire = (triggerMode == CAPTURE_TRIGGER_IMMEDIATE);
+		if (havePrevious && triggerMode == CAPTURE_TRIGGER_RISING)
+			fire = (previous < triggerLevel && value >= triggerLevel);
+		if (havePrevious && triggerMode == CAPTURE_TRIGGER_FALLING)
+			fire = (previous > triggerLevel && value <= triggerLevel);
+		previous = value;
+		havePrevious = true;
+
+		if (fire)
+		{
+			start(timeNs);
+		}
+		else
+		{
+			if (preLength == 0)
+				return false;
+			if (pre.size() < preLength)
+				pre.push_back({timeNs, (float)value});
+			else
+				pre[preNext] = {timeNs, (float)value};
+			preNext = (preNext + 1) % preLength;
+			return false;
+		}
+	}
+
+	if (captureState != CAPTURE_TRIGGERED)
+		return false;
+
+	post.push_back({timeNs, (float)value});
+	if (post.size() < postLength)
+		return false;
+	captureState = CAPTURE_DONE;
+	return true;
+}
+
+double PowerCapture::maximum() const
+{
+	double peak = 0;
+	bool first = true;
+	for (const std::vector<Sample> *part : {&pre, &post})
+	{
+		for (const Sample &sample : *part)
+		{
+			if (first || sample.value > peak)
+				peak = sample.value;
+			first = false;
+		}
+	}
+	return peak;
+}
+
+static void put(std::vector<uint8_t> &out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static void putFloat(std::vector<uint8_t> &out, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put(out, bits, 4);
+}
+
+std::vector<uint8_t> PowerCapture::encode() const
+{
+	std::vector<uint8_t> out;
+	out.reserve(28 + 8 * (pre.size() + post.size()));
+	out.insert(out.end(), {'A', 'L', '4', 'C'});
+	put(out, 1, 1);
+	put(out, captureChannel, 1);
+	put(out, triggerMode, 1);
+	put(out, 0, 1);
+	put(out, pre.size() + post.size(), 4);
+	put(out, pre.size(), 4);
+	put(out, triggerTime, 8);
+	putFloat(out, triggerLevel);
+
+	for (const std::vector<Sample> *part : {&pre, &post})
+	{
+		for (const Sample &sample : *part)
+		{
+			int32_t offset = (int32_t)(((int64_t)sample.time - (int64_t)triggerTime) / 1000);
+			put(out, (uint32_t)offset, 4);
+			putFloat(out, sample.value);
+		}
+	}
+	return out;
+}
@@ -0,0 +1,92 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef POWER_CAPTURE_H
+#define POWER_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define CAPTURE_MAX_SAMPLES 8600 // 10 s at the fastest ADS1115 rate
+
+enum
+{
+	CAPTURE_TRIGGER_IMMEDIATE,
+	CAPTURE_TRIGGER_OUTPUT, // relay, PWM duty or motor current change
+	CAPTURE_TRIGGER_RISING,
+	CAPTURE_TRIGGER_FALLING,
+	CAPTURE_TRIGGER_COUNT
+};
+
+enum
+{
+	CAPTURE_IDLE,
+	CAPTURE_ARMED,
+	CAPTURE_TRIGGERED,
+	CAPTURE_DONE
+};
+
+// One shot waveform capture of a single ADC channel with pre-trigger history.
+//
+// encode() format, all fields little endian:
+//   char[4] "AL4C", uint8 version (1), uint8 channel, uint8 trigger, uint8 reserved,
+//   uint32 sample count, uint32 pre-trigger samples, uint64 trigger time [ns, monotonic],
+//   float trigger level, then per sample int32 time from trigger [us] and float value.
+class PowerCapture
+{
+public:
+	void arm(int channel, int trigger, double level, size_t samples, size_t preSamples);
+	void abort();
+
+	// external trigger at timeNs, used by CAPTURE_TRIGGER_OUTPUT
+	void trigger(uint64_t timeNs);
+
+	// returns true when this sample completed the capture
+	bool add(double value, uint64_t timeNs);
+
+	int state() const { return captureState; }
+	int channel() const { return captureChannel; }
+	double maximum() const;
+	std::vector<uint8_t> encode() const;
+
+private:
+	struct Sample
+	{
+		uint64_t time;
+		float value;
+	};
+
+	void start(uint64_t timeNs);
+
+	int captureState = CAPTURE_IDLE;
+	int captureChannel = 0;
+	int triggerMode = CAPTURE_TRIGGER_IMMEDIATE;
+	double triggerLevel = 0;
+	size_t preLength = 0;
+	size_t postLength = 0;
+	std::vector<Sample> pre; // ring while armed
+	size_t preNext = 0;
+	std::vector<Sample> post;
+	uint64_t triggerTime = 0;
+	bool havePrevious = false;
+	double previous = 0;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "power_profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <sstream>
+
+static bool parseStep(std::string text, ProfileStep &step)
+{
+	std::replace(text.begin(), text.end(), '=', ' ');
+	std::istringstream stream(text);
+	std::string command, value;
+	stream >> command;
+	if (command.empty())
+		return false;
+
+	const char *outputs[PROFILE_OUTPUT_COUNT] = {"PWM1", "PWM2", "OUT1", "OUT2"};
+	for (int output = 0; output < PROFILE_OUTPUT_COUNT; output++)
+	{
+		if (strcasecmp(command.c_str(), outputs[output]))
+			continue;
+		if (!(stream >> value))
+			return false;
+		step.type = PROFILE_STEP_OUTPUT;
+		step.output = output;
+		if (!strcasecmp(value.c_str(), "on"))
+			step.value = 1;
+		else if (!strcasecmp(value.c_str(), "off"))
+			step.value = 0;
+		else
+		{
+			char *end;
+			step.value = strtod(value.c_str(), &end);
+			if (*end != '\0')
+				return false;
+		}
+		if (output == PROFILE_OUT1 || output == PROFILE_OUT2)
+			return step.value == 0 || step.value == 1;
+		return step.value >= 0 && step.value <= 100;
+	}
+
+	if (!strcasecmp(command.c_str(), "delay"))
+	{
+		step.type = PROFILE_STEP_DELAY;
+		return (stream >> step.timeout) && step.timeout >= 0;
+	}
+
+	if (!strcasecmp(command.c_str(), "settle"))
+	{
+		step.type = PROFILE_STEP_SETTLE;
+		step.value = 0.1;
+		step.timeout = PROFILE_SETTLE_TIMEOUT;
+		if (stream >> step.value)
+			stream >> step.timeout;
+		return step.value > 0 && step.timeout > 0;
+	}
+
+	return false;
+}
+
+bool parsePowerProfile(const char *text, std::vector<ProfileStep> &steps, std::string &error)
+{
+	steps.clear();
+	std::string script = text ? text : "";
+	std::replace(script.begin(), script.end(), '\n', ';');
+
+	std::istringstream stream(script);
+	std::string item;
+	while (std::getline(stream, item, ';'))
+	{
+		// skip blank steps
+		if (item.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+		ProfileStep step;
+		if (!parseStep(item, step))
+		{
+			error = "invalid step '" + item + "'";
+			steps.clear();
+			return false;
+		}
+		steps.push_back(step);
+	}
+	return true;
+}
+
+int profileOutputs(const std::vector<ProfileStep> &steps)
+{
+	int mask = 0;
+	for (const ProfileStep &step : steps)
+	{
+		if (step.type == PROFILE_STEP_OUTPUT)
+			mask |= 1 << step.output;
+	}
+	return mask;
+}
+
+void SettleDetector::reset()
+{
+	samples.clear();
+	sum = 0;
+	averages.clear();
+}
+
+void SettleDetector::add(uint64_t timeNs, double current)
+{
+	samples.emplace_back(timeNs, current);
+	sum += current;
+	while (samples.front().first + averageNs < timeNs)
+	{
+		sum -= samples.front().second;
+		samples.pop_front();
+	}
+
+	// averages start once the samples cover the averaging window
+	if (timeNs - samples.front().first < averageNs * 9 / 10)
+		return;
+	averages.emplace_back(timeNs, sum / samples.size());
+	while (averages.front().first + PROFILE_SETTLE_WINDOW_NS < timeNs)
+		averages.pop_front();
+}
+
+bool SettleDetector::settled(double tolerance) const
+{
+	// the kept averages must cover the whole window
+	if (averages.size() < 3 || averages.back().first - averages.front().first < PROFILE_SETTLE_WINDOW_NS * 9 / 10)
+		return false;
+	auto range = std::minmax_element(averages.begin(), averages.end(),
+									 [](const std::pair<uint64_t, double> &a, const std::pair<uint64_t, double> &b) { return a.second < b.second; });
+	return range.second->second - range.first->second < tolerance;
+}
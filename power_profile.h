@@ -0,0 +1,85 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef POWER_PROFILE_H
+#define POWER_PROFILE_H
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define PROFILE_SETTLE_WINDOW_NS 500000000ULL // current must stay within the tolerance this long
+#define PROFILE_SETTLE_TIMEOUT 10000		  // ms default limit of a settle step
+#define PROFILE_SETTLE_AVERAGE_NS 200000000ULL // shortest moving average of the settle check
+#define PROFILE_SETTLE_PERIODS 4				// PWM periods the moving average spans at least
+
+// outputs in the order of the driver loads
+enum
+{
+	PROFILE_PWM1,
+	PROFILE_PWM2,
+	PROFILE_OUT1,
+	PROFILE_OUT2,
+	PROFILE_OUTPUT_COUNT
+};
+
+enum
+{
+	PROFILE_STEP_OUTPUT, // output = value (duty % or 0/1)
+	PROFILE_STEP_DELAY,	 // wait timeout ms
+	PROFILE_STEP_SETTLE	 // wait until total current varies less than value A, at most timeout ms
+};
+
+struct ProfileStep
+{
+	int type = PROFILE_STEP_OUTPUT;
+	int output = 0;
+	double value = 0;
+	long timeout = 0;
+};
+
+// Parses a power profile script. Steps are separated by ';' or new lines, for example
+//   OUT1=on; settle 0.2 5000; OUT2=on; delay 2000; PWM1=40; PWM2=40
+// Returns false and a message naming the first bad step on error.
+bool parsePowerProfile(const char *text, std::vector<ProfileStep> &steps, std::string &error);
+
+// mask of the outputs a profile sets
+int profileOutputs(const std::vector<ProfileStep> &steps);
+
+// Tells when the total current stopped moving after a switching step. Raw samples follow the
+// on/off pulses of PWM cycling heaters, so the spread is taken over their moving average, which
+// has to span several PWM periods: over a single one the number of on samples still jitters.
+class SettleDetector
+{
+public:
+	explicit SettleDetector(uint64_t averageNs) : averageNs(averageNs) {}
+	void reset();
+	void add(uint64_t timeNs, double current);
+	bool settled(double tolerance) const;
+	double current() const { return averages.empty() ? 0 : averages.back().second; }
+
+private:
+	uint64_t averageNs;
+	std::deque<std::pair<uint64_t, double>> samples;
+	double sum = 0;
+	std::deque<std::pair<uint64_t, double>> averages;
+};
+
+#endif
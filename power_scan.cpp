@@ -0,0 +1,97 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "power_scan.h"
+
+const int adcRates[ADC_RATE_COUNT] = {8, 16, 32, 64, 128, 250, 475, 860};
+
+uint16_t adcConfig(int channel, int rateIndex, bool continuous)
+{
+	/*
+	15 		- 1 	start single conv
+	14:12	- 100 	Vin, 101 Vreg, 110 Itot, 111 Iref, 011 Ireal
+	11:9  	- 001	+-4.096V
+	8		- 0 continuous, 1 single
+	7:5		- data rate index
+	4:2		- 000 comparator
+	1:0		- 11 comparator disable
+	*/
+	static const uint16_t mux[ADC_CHANNEL_COUNT] = {0b100, 0b101, 0b110, 0b111, 0b011};
+	uint16_t config = 0x8000 | (mux[channel] << 12) | (0b001 << 9) | ((rateIndex & 0x07) << 5) | 0b00011;
+	if (!continuous)
+		config |= 0x0100;
+	return config;
+}
+
+int16_t adcDecode(int word)
+{
+	// the ADS1115 sends the MSB first
+	return (int16_t)(((word & 0xFF) << 8) | ((word >> 8) & 0xFF));
+}
+
+double adcReduce(const int16_t *raw, int count, int filter)
+{
+	if (count <= 0)
+		return 0;
+
+	if (filter == ADC_FILTER_MEDIAN)
+	{
+		int16_t sorted[ADC_MAX_OVERSAMPLE];
+		count = std::min(count, ADC_MAX_OVERSAMPLE);
+		std::copy(raw, raw + count, sorted);
+		std::sort(sorted, sorted + count);
+		return (count % 2) ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2.0;
+	}
+
+	double sum = 0;
+	for (int i = 0; i < count; i++)
+		sum += raw[i];
+	return sum / count;
+}
+
+long adcConversionTime(int rateIndex)
+{
+	return 1100000L / adcRates[rateIndex] + 50;
+}
+
+std::vector<int> buildScanSequence(const int *weights, int count)
+{
+	// smooth weighted round robin
+	std::vector<int> sequence;
+	std::vector<int> current(count, 0);
+	int total = 0;
+	for (int channel = 0; channel < count; channel++)
+		total += (weights[channel] > 0) ? weights[channel] : 0;
+
+	for (int slot = 0; slot < total; slot++)
+	{
+		int best = -1;
+		for (int channel = 0; channel < count; channel++)
+		{
+			if (weights[channel] <= 0)
+				continue;
+			current[channel] += weights[channel];
+			if (best < 0 || current[channel] > current[best])
+				best = channel;
+		}
+		current[best] -= total;
+		sequence.push_back(best);
+	}
+	return sequence;
+}
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef POWER_SCAN_H
+#define POWER_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+#define ADC_RING_SIZE 1024 // samples kept per ADS1115 channel
+#define ADC_MAX_OVERSAMPLE 16
+
+// ADS1115 inputs of the power monitor
+enum
+{
+	ADC_VIN,   // AIN0, input voltage divider
+	ADC_VREG,  // AIN1, regulated voltage divider
+	ADC_ITOT,  // AIN2, current sensor output
+	ADC_IREF,  // AIN3, current sensor reference
+	ADC_IREAL, // AIN2 - AIN3, current sensor output against its reference
+	ADC_CHANNEL_COUNT
+};
+
+// ADS1115 data rates selectable in the config register
+#define ADC_RATE_COUNT 8
+extern const int adcRates[ADC_RATE_COUNT];
+
+// oversampled conversions are reduced to one sample by their mean or median
+enum
+{
+	ADC_FILTER_MEAN,
+	ADC_FILTER_MEDIAN
+};
+
+// conversion register value read as an SMBus word (low byte first) to signed counts
+int16_t adcDecode(int word);
+
+// one value from count conversions
+double adcReduce(const int16_t *raw, int count, int filter);
+
+// config register value starting a conversion of channel at the given rate index
+uint16_t adcConfig(int channel, int rateIndex, bool continuous);
+
+// conversion time in us with margin for the +-10% oscillator tolerance
+long adcConversionTime(int rateIndex);
+
+// interleaved channel order where each channel appears weight times, spread evenly
+std::vector<int> buildScanSequence(const int *weights, int count);
+
+struct PowerSample
+{
+	uint64_t time = 0; // monotonicNs() at the end of the conversion
+	double value = 0;
+};
+
+// Single writer ring buffer of the latest samples of one channel. Readers never block
+// the writer and drop samples overwritten while they were copying.
+template <size_t N>
+class SampleRing
+{
+public:
+	void push(const PowerSample &sample)
+	{
+		uint64_t index = head.load(std::memory_order_relaxed);
+		buffer[index % N] = sample;
+		head.store(index + 1, std::memory_order_release);
+	}
+
+	// samples pushed so far
+	uint64_t total() const { return head.load(std::memory_order_acquire); }
+
+	bool latest(PowerSample &sample) const { return copy(&sample, 1) == 1; }
+
+	// copies up to max most recent samples in chronological order
+	size_t copy(PowerSample *out, size_t max) const
+	{
+		uint64_t end = head.load(std::memory_order_acquire);
+		size_t count = (size_t)std::min<uint64_t>(std::min<uint64_t>(end, N), max);
+		for (size_t i = 0; i < count; i++)
+			out[i] = buffer[(end - count + i) % N];
+
+		// drop the oldest samples if the writer has lapped them meanwhile
+		uint64_t now = head.load(std::memory_order_acquire);
+		size_t overwritten = (size_t)std::min<uint64_t>(now - end, count);
+		if (overwritten > 0)
+		{
+			for (size_t i = overwritten; i < count; i++)
+				out[i - overwritten] = out[i];
+			count -= overwritten;
+		}
+		return count;
+	}
+
+	void reset() { head.store(0, std::memory_order_release); }
+
+private:
+	PowerSample buffer[N];
+	std::atomic<uint64_t> head{0};
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "power_stats.h"
+
+#include <math.h>
+#include <algorithm>
+
+const size_t PowerStatistics::windowBuckets[STATS_WINDOW_COUNT] = {60, 900, 3600};
+
+void StatBucket::add(double value)
+{
+	min = (count == 0) ? value : std::min(min, value);
+	max = (count == 0) ? value : std::max(max, value);
+	sum += value;
+	sumSquares += value * value;
+	count++;
+}
+
+SlidingStats::SlidingStats(size_t length) : length(length), ring(length)
+{
+}
+
+void SlidingStats::reset()
+{
+	pushed = 0;
+	sum = sumSquares = 0;
+	count = 0;
+	minQueue.clear();
+	maxQueue.clear();
+}
+
+void SlidingStats::push(const StatBucket &bucket)
+{
+	// the bucket falling out of the window
+	if (pushed >= length)
+	{
+		const StatBucket &old = ring[pushed % length];
+		sum -= old.sum;
+		sumSquares -= old.sumSquares;
+		count -= old.count;
+		uint64_t oldIndex = pushed - length;
+		if (!minQueue.empty() && minQueue.front().first == oldIndex)
+			minQueue.pop_front();
+		if (!maxQueue.empty() && maxQueue.front().first == oldIndex)
+			maxQueue.pop_front();
+	}
+
+	ring[pushed % length] = bucket;
+	sum += bucket.sum;
+	sumSquares += bucket.sumSquares;
+	count += bucket.count;
+	if (bucket.count > 0)
+	{
+		while (!minQueue.empty() && minQueue.back().second >= bucket.min)
+			minQueue.pop_back();
+		minQueue.emplace_back(pushed, bucket.min);
+		while (!maxQueue.empty() && maxQueue.back().second <= bucket.max)
+			maxQueue.pop_back();
+		maxQueue.emplace_back(pushed, bucket.max);
+	}
+	pushed++;
+
+	// long runs of removals and additions leave rounding residue in the sums
+	if (count == 0)
+		sum = sumSquares = 0;
+}
+
+double SlidingStats::mean() const
+{
+	return (count > 0) ? sum / count : 0;
+}
+
+double SlidingStats::rms() const
+{
+	return (count > 0) ? sqrt(std::max(sumSquares / count, 0.0)) : 0;
+}
+
+PowerStatistics::PowerStatistics()
+{
+	for (int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+		for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+			windows.emplace_back(windowBuckets[window]);
+}
+
+void PowerStatistics::reset()
+{
+	for (SlidingStats &window : windows)
+		window.reset();
+	for (int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+		current[channel] = StatBucket();
+	bucketStart = 0;
+	stats = PowerStatsSnapshot();
+}
+
+bool PowerStatistics::add(int channel, double value, uint64_t timeNs)
+{
+	bool flushed = false;
+	if (bucketStart == 0)
+	{
+		bucketStart = timeNs;
+	}
+	else if (timeNs - bucketStart >= STATS_BUCKET_NS)
+	{
+		flush(timeNs);
+		flushed = true;
+	}
+	current[channel].add(value);
+	return flushed;
+}
+
+void PowerStatistics::flush(uint64_t timeNs)
+{
+	// seconds without any sample still move the windows on
+	uint64_t elapsed = (timeNs - bucketStart) / STATS_BUCKET_NS;
+	uint64_t empty = std::min<uint64_t>(elapsed - 1, windowBuckets[STATS_WINDOW_COUNT - 1]);
+
+	for (int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+	{
+		for (int window = 0; window < STATS_WINDOW_COUNT; window++)
+		{
+			SlidingStats &stat = windows[channel * STATS_WINDOW_COUNT + window];
+			stat.push(current[channel]);
+			for (uint64_t i = 0; i < empty; i++)
+				stat.push(StatBucket());
+
+			stats.valid[channel][window] = stat.valid();
+			stats.value[channel][window][STATS_MIN] = stat.min();
+			stats.value[channel][window][STATS_MAX] = stat.max();
+			stats.value[channel][window][STATS_MEAN] = stat.mean();
+			stats.value[channel][window][STATS_RMS] = stat.rms();
+		}
+		current[channel] = StatBucket();
+	}
+	bucketStart += elapsed * STATS_BUCKET_NS;
+	stats.time = timeNs;
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef POWER_STATS_H
+#define POWER_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+#define STATS_BUCKET_NS 1000000000ULL // samples are aggregated in 1 s buckets before entering the windows
+
+enum
+{
+	STATS_VIN,
+	STATS_VREG,
+	STATS_ITOT,
+	STATS_PTOT,
+	STATS_CHANNEL_COUNT
+};
+
+enum
+{
+	STATS_1MIN,
+	STATS_15MIN,
+	STATS_1H,
+	STATS_WINDOW_COUNT
+};
+
+enum
+{
+	STATS_MIN,
+	STATS_MAX,
+	STATS_MEAN,
+	STATS_RMS,
+	STATS_VALUE_COUNT
+};
+
+struct StatBucket
+{
+	double min = 0;
+	double max = 0;
+	double sum = 0;
+	double sumSquares = 0;
+	long count = 0;
+
+	void add(double value);
+};
+
+// Statistics over the last length buckets. Sums are updated as buckets enter and leave,
+// min and max are kept in monotonic deques, so every push is O(1) amortized.
+class SlidingStats
+{
+public:
+	explicit SlidingStats(size_t length);
+
+	void push(const StatBucket &bucket);
+	void reset();
+
+	bool valid() const { return count > 0; }
+	double min() const { return minQueue.empty() ? 0 : minQueue.front().second; }
+	double max() const { return maxQueue.empty() ? 0 : maxQueue.front().second; }
+	double mean() const;
+	double rms() const;
+
+private:
+	size_t length;
+	std::vector<StatBucket> ring;
+	uint64_t pushed = 0;
+	double sum = 0;
+	double sumSquares = 0;
+	long count = 0;
+	std::deque<std::pair<uint64_t, double>> minQueue;
+	std::deque<std::pair<uint64_t, double>> maxQueue;
+};
+
+struct PowerStatsSnapshot
+{
+	bool valid[STATS_CHANNEL_COUNT][STATS_WINDOW_COUNT] = {};
+	double value[STATS_CHANNEL_COUNT][STATS_WINDOW_COUNT][STATS_VALUE_COUNT] = {};
+	uint64_t time = 0;
+};
+
+// 1 min, 15 min and 1 h statistics of the power channels
+class PowerStatistics
+{
+public:
+	PowerStatistics();
+
+	// returns true when a bucket was closed and snapshot() changed
+	bool add(int channel, double value, uint64_t timeNs);
+	void reset();
+
+	const PowerStatsSnapshot &snapshot() const { return stats; }
+
+	static const size_t windowBuckets[STATS_WINDOW_COUNT];
+
+private:
+	void flush(uint64_t timeNs);
+
+	std::vector<SlidingStats> windows;
+	StatBucket current[STATS_CHANNEL_COUNT];
+	uint64_t bucketStart = 0;
+	PowerStatsSnapshot stats;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "pwm_interleave.h"
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+void pwmInterleave(const double *duty, int count, double frequency, int *offsetUs)
+{
+	double period = 1e6 / frequency;
+	double start = 0;
+	for (int i = 0; i < count; i++)
+	{
+		offsetUs[i] = (int)fmod(start, period);
+		start += period * duty[i] / 100;
+	}
+}
+
+double pwmOverlap(const double *duty, const int *offsetUs, int count, double frequency)
+{
+	// sweep the on/off edges of one period, wrapped pulses split in two
+	double period = 1e6 / frequency;
+	std::vector<std::pair<double, int>> edges;
+	for (int i = 0; i < count; i++)
+	{
+		double on = period * std::min(std::max(duty[i], 0.0), 100.0) / 100;
+		if (on <= 0)
+			continue;
+		double start = fmod(offsetUs[i], period);
+		double end = start + on;
+		edges.emplace_back(start, 1);
+		edges.emplace_back(std::min(end, period), -1);
+		if (end > period)
+		{
+			edges.emplace_back(0, 1);
+			edges.emplace_back(end - period, -1);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	double overlap = 0;
+	int active = 0;
+	double last = 0;
+	for (const auto &edge : edges)
+	{
+		if (active > 1)
+			overlap += edge.first - last;
+		active += edge.second;
+		last = edge.first;
+	}
+	return overlap / period;
+}
@@ -0,0 +1,32 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef PWM_INTERLEAVE_H
+#define PWM_INTERLEAVE_H
+
+// Start offsets in us for PWM outputs sharing one frequency, duty in %. Each output starts
+// where the previous one ends, so on-times only overlap when the duties add up to over 100%.
+// lgTxPwm is software timed per GPIO and counts the offset from that GPIO's own start, so the
+// phases hold only while all outputs are started back to back with the same frequency.
+void pwmInterleave(const double *duty, int count, double frequency, int *offsetUs);
+
+// fraction of the period in which more than one output is on
+double pwmOverlap(const double *duty, const int *offsetUs, int count, double frequency);
+
+#endif
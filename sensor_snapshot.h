@@ -0,0 +1,118 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef SENSOR_SNAPSHOT_H
+#define SENSOR_SNAPSHOT_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#include "power_scan.h"
+
+// monotonic clock in ns used to timestamp sensor samples
+inline uint64_t monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Latest readings of all sensors, filled by the acquisition thread
+struct SensorSnapshot
+{
+	// SHT3x temperature and humidity
+	bool shtValid = false;
+	double temperature = 0;
+	double humidity = 0;
+	double dewPoint = 0;
+	uint64_t shtTime = 0;
+
+	// MLX90614 sky temperature
+	bool mlxValid = false;
+	double skyTemperature = 0;
+	double skyDifference = 0;
+	double ambientTemperature = 0;
+	uint64_t mlxTime = 0;
+
+	// TSL2591 or legacy sky quality meter
+	bool sqmValid = false;
+	double sqm = 0;
+	double sqmError = 0;	 // standard error of sqm
+	double sqmSamples = 0; // effective number of integrations behind sqm
+	uint64_t sqmTime = 0;
+
+	// ADS1115 power monitor
+	bool powerValid = false;
+	double vin = 0;
+	double vreg = 0;
+	double itot = 0;
+	double energyAs = 0; // since connect or reset
+	double energyWs = 0;
+	double lifetimeAs = 0; // restored from the energy checkpoint
+	double lifetimeWs = 0;
+	double chargeAs = 0; // since connect, never reset
+	double adcChannel[ADC_CHANNEL_COUNT] = {0};
+	double adcRate = 0; // samples/s of the scan sequencer
+	uint64_t powerTime = 0;
+};
+
+// Wait-free single writer / single reader triple buffer. The writer never blocks
+// the reader and the reader always gets a complete snapshot.
+template <typename T>
+class SnapshotBuffer
+{
+public:
+	void publish(const T &value)
+	{
+		buffers[backIndex] = value;
+		backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// returns true when the snapshot changed since the previous read
+	bool read(T &value)
+	{
+		bool fresh = middle.load(std::memory_order_relaxed) & FRESH;
+		if (fresh)
+		{
+			frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+		}
+		value = buffers[frontIndex];
+		return fresh;
+	}
+
+	void reset()
+	{
+		for (T &buffer : buffers)
+			buffer = T();
+		middle = 1;
+		backIndex = 0;
+		frontIndex = 2;
+	}
+
+private:
+	static constexpr int FRESH = 4;
+	static constexpr int INDEX_MASK = 3;
+
+	T buffers[3];
+	std::atomic<int> middle{1};
+	int backIndex = 0;
+	int frontIndex = 2;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "sqm_estimator.h"
+
+#include <math.h>
+#include <algorithm>
+
+void SqmEstimator::reset()
+{
+	lastTime = 0;
+	countSum = exposureSum = fluxSquareSum = weightSquareSum = shotVariance = 0;
+}
+
+void SqmEstimator::add(double counts, double exposure, uint64_t timeNs, double timeConstant)
+{
+	if (exposure <= 0)
+		return;
+
+	if (lastTime != 0 && timeNs > lastTime && timeConstant > 0)
+	{
+		double decay = exp(-(double)(timeNs - lastTime) / 1e9 / timeConstant);
+		countSum *= decay;
+		exposureSum *= decay;
+		fluxSquareSum *= decay;
+		weightSquareSum *= decay * decay;
+		shotVariance *= decay * decay;
+	}
+	lastTime = timeNs;
+
+	double sampleFlux = counts / exposure;
+	countSum += counts;
+	exposureSum += exposure;
+	fluxSquareSum += exposure * sampleFlux * sampleFlux;
+	weightSquareSum += exposure * exposure;
+	shotVariance += counts;
+}
+
+double SqmEstimator::fluxError() const
+{
+	if (exposureSum <= 0)
+		return 0;
+
+	double shot = shotVariance / (exposureSum * exposureSum);
+	double spread = std::max(fluxSquareSum / exposureSum - flux() * flux(), 0.0) / effectiveSamples();
+	return sqrt(std::max(shot, spread));
+}
+
+double SqmEstimator::magnitudeError() const
+{
+	return valid() ? 1.086 * fluxError() / flux() : 0;
+}
+
+double SqmEstimator::effectiveSamples() const
+{
+	return (weightSquareSum > 0) ? exposureSum * exposureSum / weightSquareSum : 0;
+}
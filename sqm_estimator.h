@@ -0,0 +1,57 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef SQM_ESTIMATOR_H
+#define SQM_ESTIMATOR_H
+
+#include <stdint.h>
+
+// Exponentially weighted sky flux estimate updated after every integration. Counts and
+// exposure are summed with a time decay, which weights each integration by its exposure
+// as shot noise requires, and the spread of the integrations gives the standard error.
+class SqmEstimator
+{
+public:
+	void reset();
+
+	// adds an integration of counts visible counts over exposure (normalised) ending at timeNs
+	void add(double counts, double exposure, uint64_t timeNs, double timeConstant);
+
+	bool valid() const { return exposureSum > 0 && countSum > 0; }
+	double flux() const { return countSum / exposureSum; }
+
+	// standard error of flux(), never below the shot noise of the counts
+	double fluxError() const;
+
+	// standard error in magnitudes
+	double magnitudeError() const;
+
+	// number of equally weighted integrations the estimate is worth
+	double effectiveSamples() const;
+
+private:
+	uint64_t lastTime = 0;
+	double countSum = 0;		// sum of w * counts
+	double exposureSum = 0;		// sum of w * exposure
+	double fluxSquareSum = 0;	// sum of w * exposure * flux^2
+	double weightSquareSum = 0; // sum of (w * exposure)^2
+	double shotVariance = 0;	// sum of w^2 * counts
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "stepper_motion.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#ifdef AL4PI_FAKE_LGPIO
+#include "bench/fake_lgpio.h"
+#else
+#include <lgpio.h>
+#endif
+
+StepperMotion::StepperMotion(int dirPin, int stepPin) : dirPin(dirPin), stepPin(stepPin)
+{
+}
+
+void StepperMotion::pulse(int direction, bool reverse)
+{
+	if (reverse)
+	{
+		lgGpioWrite(gpioHandle, dirPin, (direction < 0) ? 1 : 0);
+	}
+	else
+	{
+		lgGpioWrite(gpioHandle, dirPin, (direction < 0) ? 0 : 1);
+	}
+	// time stored before the count so a reader never sees a count without its time
+	long step = stepCount + 1;
+	stepTimes[step % STEP_TIME_HISTORY] = lguTimestamp();
+	stepCount = step; // counted before the pulse so a switch edge latches the step that caused it
+	lgGpioWrite(gpioHandle, stepPin, 1);
+	usleep(10);
+	lgGpioWrite(gpioHandle, stepPin, 0);
+}
+
+long StepperMotion::stepAt(uint64_t timestampNs) const
+{
+	long count = stepCount;
+	for (long step = count; step > 0 && step > count - STEP_TIME_HISTORY; step--)
+	{
+		if (stepTimes[step % STEP_TIME_HISTORY] <= timestampNs)
+			return step;
+	}
+	return count;
+}
+
+double StepperMotion::stepDelay(const MotionProfile &profile, long stepIndex, long totalSteps)
+{
+	long rampDistance = std::min(stepIndex, totalSteps - stepIndex);
+	if (rampDistance < profile.rampSteps)
+	{
+		return profile.stepDelay * (1 + (ACCEL_START_FACTOR - 1) * (double)(profile.rampSteps - rampDistance) / profile.rampSteps);
+	}
+	return profile.stepDelay;
+}
+
+uint32_t StepperMotion::run(uint32_t startPos, uint32_t targetPos, int direction, long backlashSteps, const MotionProfile &profile,
+							volatile bool &abort, const std::function<void(uint32_t)> &onPosition, const std::function<void(bool)> &onPhase)
+{
+	uint32_t currentPos = startPos;
+	long totalSteps = labs((long)targetPos - (long)startPos) + backlashSteps;
+	long stepIndex = 0;
+	int boosting = -1;
+
+	while (currentPos != targetPos && !abort)
+	{
+		if (currentPos % 100 == 0 && onPosition)
+		{
+			onPosition(currentPos);
+		}
+
+		// acceleration and deceleration ramps run with boost current, the rest at cruise current
+		long rampDistance = std::min(stepIndex, totalSteps - stepIndex);
+		if ((rampDistance < profile.rampSteps) != boosting)
+		{
+			boosting = (rampDistance < profile.rampSteps);
+			if (onPhase)
+				onPhase(boosting);
+		}
+
+		pulse(direction, profile.reverse);
+
+		if (backlashSteps <= 0)
+		{ // Only Count the position change if it is not due to backlash
+			currentPos += direction;
+		}
+		else
+		{ // Don't count the backlash position change, just decrement the counter
+			backlashSteps -= 1;
+		}
+
+		usleep(stepDelay(profile, stepIndex, totalSteps));
+		stepIndex++;
+	}
+
+	return currentPos;
+}
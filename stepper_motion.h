@@ -0,0 +1,68 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef STEPPER_MOTION_H
+#define STEPPER_MOTION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+
+#define ACCEL_START_FACTOR 4 // step delay multiplier at the start of the acceleration ramp
+#define STEP_TIME_HISTORY 256 // pulse timestamps kept to match late GPIO alerts to the step that caused them
+
+struct MotionProfile
+{
+	double stepDelay = 2000; // us between steps at cruise speed
+	long rampSteps = 0;		 // length of the acceleration and deceleration ramps
+	bool reverse = false;	 // swap DIR_PIN levels
+};
+
+// Step generator of the focuser, free of INDI so it can be driven by the benchmark as well
+class StepperMotion
+{
+public:
+	StepperMotion(int dirPin, int stepPin);
+
+	void setHandle(int handle) { gpioHandle = handle; }
+
+	// single step in the given direction
+	void pulse(int direction, bool reverse);
+
+	// runs the move on the calling thread and returns the position reached
+	uint32_t run(uint32_t startPos, uint32_t targetPos, int direction, long backlashSteps, const MotionProfile &profile,
+				 volatile bool &abort, const std::function<void(uint32_t)> &onPosition, const std::function<void(bool)> &onPhase);
+
+	// delay after the step at stepIndex of a move totalSteps long
+	static double stepDelay(const MotionProfile &profile, long stepIndex, long totalSteps);
+
+	// pulses sent so far, counted before each pulse
+	std::atomic<long> stepCount{0};
+
+	// step count of the last pulse sent at or before the lguTimestamp() time, the current count
+	// when the time is older than the recorded history
+	long stepAt(uint64_t timestampNs) const;
+
+private:
+	std::atomic<uint64_t> stepTimes[STEP_TIME_HISTORY] = {};
+	int gpioHandle = -1;
+	int dirPin;
+	int stepPin;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "system_metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool SystemMetrics::open()
+{
+	close();
+	thermalFd = ::open(SYSTEM_THERMAL_ZONE, O_RDONLY | O_CLOEXEC);
+	uptimeFd = ::open(SYSTEM_UPTIME, O_RDONLY | O_CLOEXEC);
+	loadFd = ::open(SYSTEM_LOADAVG, O_RDONLY | O_CLOEXEC);
+	return thermalFd >= 0 && uptimeFd >= 0 && loadFd >= 0;
+}
+
+void SystemMetrics::close()
+{
+	int *fds[3] = {&thermalFd, &uptimeFd, &loadFd};
+	for (int *fd : fds)
+	{
+		if (*fd >= 0)
+			::close(*fd);
+		*fd = -1;
+	}
+}
+
+bool SystemMetrics::readFile(int fd, char *buffer, size_t size)
+{
+	if (fd < 0)
+		return false;
+	ssize_t length = pread(fd, buffer, size - 1, 0);
+	if (length <= 0)
+		return false;
+	buffer[length] = 0;
+	return true;
+}
+
+bool SystemMetrics::cpuTemperature(double &celsius) const
+{
+	// millidegrees
+	char buffer[16];
+	if (!readFile(thermalFd, buffer, sizeof(buffer)))
+		return false;
+	char *end;
+	long value = strtol(buffer, &end, 10);
+	if (end == buffer)
+		return false;
+	celsius = value / 1000.0;
+	return true;
+}
+
+bool SystemMetrics::uptime(double &seconds) const
+{
+	// "uptime idle" in seconds
+	char buffer[64];
+	if (!readFile(uptimeFd, buffer, sizeof(buffer)))
+		return false;
+	char *end;
+	seconds = strtod(buffer, &end);
+	return end != buffer;
+}
+
+bool SystemMetrics::loadAverage(double load[3]) const
+{
+	// "1min 5min 15min running/total lastpid"
+	char buffer[64];
+	if (!readFile(loadFd, buffer, sizeof(buffer)))
+		return false;
+	char *position = buffer;
+	for (int i = 0; i < 3; i++)
+	{
+		char *end;
+		load[i] = strtod(position, &end);
+		if (end == position)
+			return false;
+		position = end;
+	}
+	return true;
+}
+
+void SystemMetrics::formatTemperature(double celsius, char *buffer, size_t size)
+{
+	snprintf(buffer, size, "%0.1f", celsius);
+}
+
+void SystemMetrics::formatUptime(double seconds, char *buffer, size_t size)
+{
+	long minutes = (long)(seconds / 60);
+	long days = minutes / (24 * 60);
+	int hours = (int)(minutes / 60 % 24);
+	if (days > 0)
+		snprintf(buffer, size, "%ld day%s, %d:%02d", days, (days > 1) ? "s" : "", hours, (int)(minutes % 60));
+	else
+		snprintf(buffer, size, "%d:%02d", hours, (int)(minutes % 60));
+}
+
+void SystemMetrics::formatLoad(const double load[3], char *buffer, size_t size)
+{
+	snprintf(buffer, size, "%0.2f / %0.2f / %0.2f", load[0], load[1], load[2]);
+}
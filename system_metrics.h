@@ -0,0 +1,58 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef SYSTEM_METRICS_H
+#define SYSTEM_METRICS_H
+
+#include <stddef.h>
+
+#define SYSTEM_THERMAL_ZONE "/sys/class/thermal/thermal_zone0/temp"
+#define SYSTEM_UPTIME "/proc/uptime"
+#define SYSTEM_LOADAVG "/proc/loadavg"
+
+// Host metrics read from procfs and sysfs. The files are opened once and re-read with
+// pread from offset 0, which makes the kernel regenerate their content, so an update
+// costs one system call per value and no process spawn or allocation.
+class SystemMetrics
+{
+public:
+	~SystemMetrics() { close(); }
+
+	// returns false if any of the files cannot be opened, the others remain usable
+	bool open();
+	void close();
+
+	bool cpuTemperature(double &celsius) const;
+	bool uptime(double &seconds) const;
+	bool loadAverage(double load[3]) const;
+
+	// text as shown in the system info property
+	static void formatTemperature(double celsius, char *buffer, size_t size);
+	static void formatUptime(double seconds, char *buffer, size_t size);
+	static void formatLoad(const double load[3], char *buffer, size_t size);
+
+private:
+	static bool readFile(int fd, char *buffer, size_t size);
+
+	int thermalFd = -1;
+	int uptimeFd = -1;
+	int loadFd = -1;
+};
+
+#endif
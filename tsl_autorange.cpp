@@ -0,0 +1,121 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#include "tsl_autorange.h"
+
+#include <math.h>
+#include <algorithm>
+
+// typical gains of the low, medium, high and max settings
+const double TslAutoRange::gains[TSL_GAIN_COUNT] = {1.0, 25.0, 428.0, 9876.0};
+
+TslAutoRange::TslAutoRange()
+{
+	reset();
+}
+
+void TslAutoRange::reset()
+{
+	// short probe at max gain, the dark sky case needs it and a bright sky saturates quickly
+	gainIndex = TSL_GAIN_COUNT - 1;
+	timeIndex = 0;
+	visCounts = exposure = 0;
+	count = 0;
+	elapsed = 0;
+}
+
+uint8_t TslAutoRange::control() const
+{
+	return (uint8_t)((gainIndex << 4) | timeIndex);
+}
+
+TslAutoRange::Result TslAutoRange::addReading(int full, int ir)
+{
+	if (full >= fullScale(timeIndex) * TSL_SATURATION_LEVEL || ir >= fullScale(timeIndex) * TSL_SATURATION_LEVEL)
+	{
+		// drop the gain first, then shorten the integration
+		if (gainIndex > 0)
+			gainIndex--;
+		else if (timeIndex > 0)
+			timeIndex = 0;
+		return TSL_SATURATED;
+	}
+
+	double settingExposure = gains[gainIndex] * integrationMs();
+	elapsed += integrationMs();
+	Result result = TSL_REJECTED;
+	if (full >= ir)
+	{
+		visCounts += full - ir;
+		exposure += settingExposure;
+		count++;
+		lastCounts = full - ir;
+		lastExposure = settingExposure / (gains[TSL_GAIN_COUNT - 1] * 600.0);
+		result = TSL_PENDING;
+	}
+
+	// a bright sky keeps integrating for a while to cut the photon noise, a dark one stops at the target
+	bool precise = visCounts >= TSL_PRECISION_COUNTS || (visCounts >= TSL_TARGET_COUNTS && elapsed >= TSL_PRECISION_TIME);
+	if (precise || (elapsed >= TSL_MAX_ACCUMULATION && visCounts > 0))
+	{
+		lastVisible = visCounts * (gains[TSL_GAIN_COUNT - 1] * 600.0) / exposure;
+		lastIntegrations = count;
+		visCounts = exposure = 0;
+		count = 0;
+		elapsed = 0;
+		result = TSL_READY;
+	}
+
+	// the full channel limits the setting, visible counts decide how many integrations are needed
+	selectNext(full / settingExposure, std::max(full - ir, 0) / settingExposure);
+	return result;
+}
+
+void TslAutoRange::selectNext(double fullRate, double visibleRate)
+{
+	// a completely dark reading gives no estimate, assume a single count
+	double minimumRate = 1.0 / (gains[gainIndex] * integrationMs());
+	fullRate = std::max(fullRate, minimumRate);
+	visibleRate = std::max(visibleRate, minimumRate);
+
+	double target = (elapsed < TSL_PRECISION_TIME) ? TSL_PRECISION_COUNTS : TSL_TARGET_COUNTS;
+	double remaining = std::max(target - visCounts, 1.0);
+	int bestGain = 0, bestTime = 0;
+	double bestIntegrations = 1e9, bestDuration = 1e9;
+	for (int g = 0; g < TSL_GAIN_COUNT; g++)
+	{
+		for (int t = 0; t < TSL_TIME_COUNT; t++)
+		{
+			double settingExposure = gains[g] * (t + 1) * 100;
+			if (fullRate * settingExposure > fullScale(t) * TSL_HEADROOM && !(g == 0 && t == 0))
+				continue;
+			double integrations = ceil(remaining / (visibleRate * settingExposure));
+			double duration = integrations * (t + 1) * 100;
+			if (integrations < bestIntegrations || (integrations == bestIntegrations && duration < bestDuration))
+			{
+				bestIntegrations = integrations;
+				bestDuration = duration;
+				bestGain = g;
+				bestTime = t;
+			}
+		}
+	}
+	gainIndex = bestGain;
+	timeIndex = bestTime;
+}
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ Copyright(c) 2023 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+
+#ifndef TSL_AUTORANGE_H
+#define TSL_AUTORANGE_H
+
+#include <stdint.h>
+
+#define TSL_TARGET_COUNTS 500	  // visible counts accumulated for one SQM reading
+#define TSL_PRECISION_COUNTS 40000 // visible counts aimed for while the reading is younger than TSL_PRECISION_TIME
+#define TSL_PRECISION_TIME 2400	  // ms of integration a bright sky reading may take to reach the fixed setting's precision
+#define TSL_MAX_ACCUMULATION 90000 // ms of integration after which a reading is produced below the target
+#define TSL_SATURATION_LEVEL 0.98 // fraction of the full scale treated as saturated
+#define TSL_HEADROOM 0.5		  // fraction of the full scale a new setting may be predicted to reach
+#define TSL_GAIN_COUNT 4
+#define TSL_TIME_COUNT 6
+
+// Gain and integration time selection of the TSL2591, free of INDI and lgpio so it can be simulated
+class TslAutoRange
+{
+public:
+	enum Result
+	{
+		TSL_PENDING,	// reading accumulated, more integrations needed
+		TSL_SATURATED,	// reading discarded, sensitivity lowered
+		TSL_REJECTED,	// reading discarded, ir above full
+		TSL_READY		// target reached, visible() holds the result
+	};
+
+	TslAutoRange();
+
+	// forget accumulated readings and return to the probe setting
+	void reset();
+
+	// control register value (gain and integration time) of the current setting
+	uint8_t control() const;
+	int integrationMs() const { return (timeIndex + 1) * 100; }
+	int gain() const { return gainIndex; }
+
+	// processes the channel counts read at the current setting and picks the next setting
+	Result addReading(int full, int ir);
+
+	// visible flux of the last completed reading, normalised to max gain and 600 ms
+	double visible() const { return lastVisible; }
+	int integrations() const { return lastIntegrations; }
+
+	// visible counts and exposure (in max gain / 600 ms units) of the last accepted integration
+	int readingCounts() const { return lastCounts; }
+	double readingExposure() const { return lastExposure; }
+
+	static int fullScale(int timeIndex) { return timeIndex == 0 ? 37888 : 65535; }
+	static const double gains[TSL_GAIN_COUNT];
+
+private:
+	void selectNext(double fullRate, double visibleRate);
+
+	int gainIndex;
+	int timeIndex;
+	double visCounts = 0;	// raw visible counts accumulated
+	double exposure = 0;	// sum of gain x integration time of the accumulated readings
+	int count = 0;
+	long elapsed = 0;		// ms of integration accumulated
+	double lastVisible = 0;
+	int lastIntegrations = 0;
+	int lastCounts = 0;
+	double lastExposure = 0;
+};
+
+#endif